@@ -0,0 +1,164 @@
+/*
+    DSC Keybus Interface - native Arduino shim
+
+    https://github.com/taligentx/dscKeybusInterface
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Arduino.h"
+#include <time.h>
+
+HardwareSerial Serial;
+
+const byte nativePins = 64;
+
+static unsigned long long virtualMicros;
+static byte pinInput[nativePins];
+static byte pinOutput[nativePins];
+static void (*pinHandler[nativePins])();
+static void (*timerHandler)();
+static unsigned long long timerDeadline;
+static bool timerArmed;
+
+
+unsigned long micros() {
+  return (unsigned long)virtualMicros;
+}
+
+
+unsigned long millis() {
+  return (unsigned long)(virtualMicros / 1000);
+}
+
+
+void delay(unsigned long ms) {
+  nativeAdvance(ms * 1000);
+}
+
+
+void delayMicroseconds(unsigned int us) {
+  nativeAdvance(us);
+}
+
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < nativePins && mode == INPUT_PULLUP) pinInput[pin] = HIGH;
+}
+
+
+int digitalRead(uint8_t pin) {
+  if (pin >= nativePins) return LOW;
+  return pinInput[pin];
+}
+
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < nativePins) pinOutput[pin] = value ? HIGH : LOW;
+}
+
+
+// Handlers are called on every change set with nativeSetPin(), the only mode used by the library
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int /* mode */) {
+  if (interrupt < nativePins) pinHandler[interrupt] = handler;
+}
+
+
+void detachInterrupt(uint8_t interrupt) {
+  if (interrupt < nativePins) pinHandler[interrupt] = NULL;
+}
+
+
+char *itoa(int value, char *string, int base) {
+  if (base == 16) sprintf(string, "%x", value);
+  else sprintf(string, "%d", value);
+  return string;
+}
+
+
+void nativeTimerAttach(void (*handler)()) {
+  timerHandler = handler;
+  timerArmed = false;
+}
+
+
+void nativeTimerStart(unsigned long us) {
+  timerDeadline = virtualMicros + us;
+  timerArmed = true;
+}
+
+
+void nativeSetPin(uint8_t pin, uint8_t value) {
+  if (pin >= nativePins) return;
+  value = value ? HIGH : LOW;
+  if (pinInput[pin] == value) return;
+  pinInput[pin] = value;
+  if (pinHandler[pin] != NULL) pinHandler[pin]();
+}
+
+
+int nativeGetOutput(uint8_t pin) {
+  if (pin >= nativePins) return LOW;
+  return pinOutput[pin];
+}
+
+
+void nativeAdvance(unsigned long us) {
+  unsigned long long target = virtualMicros + us;
+  while (timerArmed && timerDeadline <= target) {
+    virtualMicros = timerDeadline;
+    timerArmed = false;
+    if (timerHandler != NULL) timerHandler();
+  }
+  virtualMicros = target;
+}
+
+
+unsigned long nativeCycleCount() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long)now.tv_sec * 1000000000UL + (unsigned long)now.tv_nsec;
+}
+
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t count = 0;
+  while (size--) count += write(*buffer++);
+  return count;
+}
+
+
+size_t Print::print(const __FlashStringHelper *string) {
+  return write(reinterpret_cast<const char *>(string));
+}
+
+
+size_t Print::print(long value, int base) {
+  if (value < 0 && base == DEC) return print('-') + print((unsigned long)-value, base);
+  return print((unsigned long)value, base);
+}
+
+
+size_t Print::print(unsigned long value, int base) {
+  char digits[8 * sizeof(unsigned long) + 1];
+  char *digit = &digits[sizeof(digits) - 1];
+  *digit = '\0';
+  if (base < 2) base = DEC;
+  do {
+    byte remainder = value % base;
+    *--digit = remainder < 10 ? '0' + remainder : 'A' + remainder - 10;
+    value /= base;
+  } while (value);
+  return write(digit);
+}
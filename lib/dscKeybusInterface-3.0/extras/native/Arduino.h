@@ -0,0 +1,134 @@
+/*
+    DSC Keybus Interface - native Arduino shim
+
+    Minimal subset of the Arduino core used by the PowerSeries interface so that the library can be compiled and
+    run on a Linux host.  Time and pins are virtual: a driver sets the Keybus clock and data lines with
+    nativeSetPin() and advances time with nativeAdvance(), which delivers the pin change interrupt and the
+    250us timer to the library synchronously.
+
+    https://github.com/taligentx/dscKeybusInterface
+
+    This library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef DSC_NATIVE
+#define DSC_NATIVE
+#endif
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+
+#define BIN 2
+#define OCT 8
+#define DEC 10
+#define HEX 16
+
+#define PROGMEM
+#define F(string) (reinterpret_cast<const __FlashStringHelper *>(string))
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define pgm_read_ptr(address) (*(void * const *)(address))
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+#define digitalPinToInterrupt(pin) (pin)
+
+class __FlashStringHelper;
+
+// Interrupts are delivered synchronously from nativeAdvance(), so there is nothing to mask
+inline void noInterrupts() {}
+inline void interrupts() {}
+inline void yield() {}
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int mode);
+void detachInterrupt(uint8_t interrupt);
+
+char *itoa(int value, char *string, int base);
+
+// Virtual hardware used by the library and the driver
+void nativeTimerAttach(void (*handler)());  // One-shot timer used in place of Timer1, NULL detaches
+void nativeTimerStart(unsigned long us);    // Arms the timer to call its handler in us microseconds
+void nativeSetPin(uint8_t pin, uint8_t value);  // Sets an input pin, calling its interrupt handler on change
+int nativeGetOutput(uint8_t pin);               // Reads an output pin set with digitalWrite()
+void nativeAdvance(unsigned long us);           // Advances virtual time, firing the timer if it expires
+unsigned long nativeCycleCount();               // Host nanoseconds, used as the cycle counter for DSC_ISR_STATS
+
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *string) { return write((const uint8_t *)string, strlen(string)); }
+
+    size_t print(const __FlashStringHelper *string);
+    size_t print(const char *string) { return write(string); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(int value, int base = DEC) { return print((long)value, base); }
+    size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+
+    size_t println() { return write((uint8_t)'\n'); }
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(T value, int base) { size_t n = print(value, base); return n + println(); }
+};
+
+
+class Stream : public Print {
+  public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+};
+
+
+class HardwareSerial : public Stream {
+  public:
+    void begin(unsigned long) {}
+    void flush() { fflush(stdout); }
+    size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+    using Print::write;
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif  // Arduino_h
@@ -0,0 +1,614 @@
+/*
+ *  DSC Keybus Trace (native)
+ *
+ *  Runs the PowerSeries interface on a Linux host with the Arduino shim in this directory.  Keybus clock and data
+ *  edges are fed through virtual pins, so dscClockInterrupt() and dscDataInterrupt() capture commands exactly as
+ *  they would on hardware, and loop() is called as fast as possible to decode them.
+ *
+ *  Usage:
+ *    keybusTrace trace.txt       Replays an edge trace and prints each decoded command, like the KeybusReader example
+ *    keybusTrace -q trace.txt    Replays an edge trace and only prints the totals
+ *    keybusTrace --bench 100000  Synthesizes 100000 commands and prints the decode throughput
+ *    keybusTrace --status 100000 Synthesizes 100000 0x05 status commands, changing every 16th, as on an idle panel
+ *    keybusTrace --write 1000    Synthesizes 1000 cycles of 0x05 and 0x1B status commands while writing keys, and
+ *                                prints the keys read from the write pin and the write totals
+ *    keybusTrace --replay capture.dsc  Replays a binary capture (-D DSC_CAPTURE) and prints the cost per command
+ *
+ *  With -D DSC_CAPTURE, "-w capture.dsc" also records the trace or benchmark commands to a binary capture, the format
+ *  is described in dscKeybus.h.  Captures can be recorded on hardware with captureBegin(Serial) and replayed here
+ *  at many times real-time speed.
+ *
+ *  Edge traces are text files with one sample per line: the time in microseconds, the clock line level, and the
+ *  data line level, separated by spaces or commas - for example a CSV export from a logic analyzer:
+ *
+ *    # time_us,clock,data
+ *    0,1,1
+ *    12000,0,1
+ *    12500,1,0
+ *
+ *  Lines starting with '#' and lines that do not start with a number are skipped.
+ *
+ *  The write scenario runs the virtual keypad as a sketch would: keys for partitions 2, 3, 5, and 6 in a single
+ *  write(), a panic alarm key that the panel verifies with 0x1C, and a zone bypass macro on partition 1.  With
+ *  -D DSC_LATENCY_STATS, the write and alarm verification latency histograms are printed with the totals.
+ *
+ *  With -D DSC_ISR_STATS, the interrupt timing is printed after each run - the cycle counter is the host clock in
+ *  nanoseconds, so compare runs of the same build options on the same host rather than absolute values.
+ *
+ *  Build (from the library directory):
+ *    g++ -O2 -std=gnu++11 -I extras/native -I src extras/native/Arduino.cpp extras/native/keybusTrace.cpp \
+ *        src/dscKeybusInterface.cpp src/dscKeybusProcessData.cpp src/dscKeybusPrintData.cpp -o keybusTrace
+ */
+#include <dscKeybusInterface.h>
+#include <time.h>
+
+#define dscClockPin 2
+#define dscReadPin  3
+#define dscWritePin 4
+
+dscKeybusInterface dsc(dscClockPin, dscReadPin, dscWritePin);
+
+const unsigned long clockHalfPeriod = 500;  // Keybus clock runs at ~1kHz
+const unsigned long commandGap = 2500;      // Clock is held high between commands
+
+static bool quiet = false;
+static unsigned long commandsDecoded;
+static unsigned long long decodeNanoseconds;
+
+// Write pin levels sampled while the clock is low, indexed by the panel bits sent in the command - a virtual keypad
+// write pulls the data line low for 0 bits.  Bit 0 is sampled as the clock falls after the previous command, where
+// alarm keys start.
+static byte keypadBits[8 * dscReadSize + 2];
+static byte keypadBitCount;
+static byte keypadNextBit;
+
+
+#if defined(DSC_CAPTURE)
+// Writes the capture output to a file
+class FilePrint : public Print {
+  public:
+    FilePrint(FILE *setFile) : file(setFile) {}
+    size_t write(uint8_t c) { return fputc(c, file) == EOF ? 0 : 1; }
+    size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, file); }
+    using Print::write;
+
+  private:
+    FILE *file;
+};
+#endif
+
+
+static unsigned long long hostNanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+// Prints a timestamp in seconds with 2 decimal precision
+static void printTimestamp() {
+  printf("%9.2f:", millis() / 1000.0);
+}
+
+
+static void printPanel() {
+  printTimestamp();
+  Serial.print(" ");
+  dsc.printPanelBinary();
+  Serial.print(" [");
+  dsc.printPanelCommand();
+  Serial.print("] ");
+  dsc.printPanelMessage();
+  Serial.println();
+}
+
+
+static void printModule() {
+  printTimestamp();
+  Serial.print(" ");
+  dsc.printModuleBinary();
+  Serial.print(" ");
+  dsc.printModuleMessage();
+  Serial.println();
+}
+
+
+// Runs loop() until the panel buffer is empty, timing only the decoding
+static void runLoop() {
+  while (true) {
+    unsigned long long startTime = hostNanoseconds();
+    bool decoded = dsc.loop();
+    decodeNanoseconds += hostNanoseconds() - startTime;
+    if (!decoded) break;
+    commandsDecoded++;
+
+    if (dsc.statusChanged) dsc.statusChanged = false;
+
+    if (dsc.bufferOverflow) {
+      if (!quiet) Serial.println(F("Keybus buffer overflow"));
+      dsc.bufferOverflow = false;
+    }
+
+    if (quiet) {
+      dsc.handleModule();
+      continue;
+    }
+
+    printPanel();
+    if (dsc.handleModule()) printModule();
+  }
+
+  while (dsc.handleModule()) if (!quiet) printModule();
+}
+
+
+// Sends one Keybus bit: the panel sets data while the clock is high and releases the data line while the clock is
+// low for keypads and modules
+static void sendBit(bool dataBit) {
+  nativeSetPin(dscReadPin, dataBit);
+  nativeSetPin(dscClockPin, HIGH);
+  nativeAdvance(clockHalfPeriod);
+  nativeSetPin(dscReadPin, HIGH);
+  nativeSetPin(dscClockPin, LOW);
+  if (keypadBitCount < sizeof(keypadBits)) keypadBits[keypadBitCount++] = nativeGetOutput(dscWritePin);
+  nativeAdvance(clockHalfPeriod);
+}
+
+
+// Sends a panel command as Keybus bits: the command byte, the stop bit, and the remaining bytes.  The clock is then
+// held high to end the command, which the interface detects on the next falling edge.
+static void sendCommand(const byte command[], byte commandBytes) {
+  keypadBits[0] = keypadNextBit;
+  keypadBitCount = 1;
+  for (byte commandByte = 0; commandByte < commandBytes; commandByte++) {
+    for (int bit = 7; bit >= 0; bit--) sendBit(bitRead(command[commandByte], bit));
+    if (commandByte == 0) sendBit(1);
+  }
+  nativeSetPin(dscReadPin, HIGH);
+  nativeSetPin(dscClockPin, HIGH);
+  nativeAdvance(commandGap);
+  nativeSetPin(dscClockPin, LOW);
+  keypadNextBit = nativeGetOutput(dscWritePin);
+  nativeAdvance(clockHalfPeriod);
+}
+
+
+// Returns the key written by the virtual keypad from a bit of the last command, or -1 if no key was written
+static int keypadKey(byte startBit) {
+  if (startBit + 8 > keypadBitCount) return -1;
+
+  byte key = 0;
+  bool keyWritten = false;
+  for (byte bit = startBit; bit < startBit + 8; bit++) {
+    key <<= 1;
+    if (keypadBits[bit]) keyWritten = true;
+    else key |= 1;
+  }
+  return keyWritten ? key : -1;
+}
+
+
+// Sets the checksum byte of a command: the sum of the preceding bytes
+static void setChecksum(byte command[], byte commandBytes) {
+  byte checksum = 0;
+  for (byte i = 0; i < commandBytes - 1; i++) checksum += command[i];
+  command[commandBytes - 1] = checksum;
+}
+
+
+// Synthesizes a mix of status, zone, and event commands, varying the data so that the interface does not skip them
+// as redundant
+static void runBenchmark(unsigned long commandCount) {
+  byte status05[] = {0x05, 0x81, 0x01, 0x10, 0xC7};
+  byte status27[] = {0x27, 0x81, 0x01, 0x10, 0xC7, 0x00, 0x00};
+  byte status16[] = {0x16, 0x0E, 0x23, 0xF1, 0x00};
+  byte event_A5[] = {0xA5, 0x18, 0x0E, 0xED, 0x80, 0x00, 0x00, 0x00};
+
+  setChecksum(status16, sizeof(status16));
+  setChecksum(event_A5, sizeof(event_A5));
+
+  unsigned long long startTime = hostNanoseconds();
+  for (unsigned long i = 0; i < commandCount; i++) {
+    switch (i % 4) {
+      case 0:
+        status05[1] = (i & 0x04) ? 0x80 : 0x81;
+        sendCommand(status05, sizeof(status05));
+        break;
+      case 1:
+        status27[5] = i >> 2;
+        setChecksum(status27, sizeof(status27));
+        sendCommand(status27, sizeof(status27));
+        break;
+      case 2:
+        sendCommand(status16, sizeof(status16));
+        break;
+      case 3:
+        event_A5[4] = 0x80 | ((i >> 2) & 0x3F);
+        setChecksum(event_A5, sizeof(event_A5));
+        sendCommand(event_A5, sizeof(event_A5));
+        break;
+    }
+    runLoop();
+  }
+  unsigned long long totalNanoseconds = hostNanoseconds() - startTime;
+
+  printf("Commands sent: %lu, decoded: %lu, Keybus time: %.1fs\n", commandCount, commandsDecoded, millis() / 1000.0);
+  printf("Capture and decode: %.0f commands/s\n", commandsDecoded * 1e9 / totalNanoseconds);
+  printf("loop() decode only: %.0f commands/s, %.0f ns/command\n", commandsDecoded * 1e9 / decodeNanoseconds,
+         (double)decodeNanoseconds / commandsDecoded);
+}
+
+
+// Synthesizes 0x05 status commands as sent by an idle panel: the status repeats and only every 16th command changes,
+// so most commands are skipped as redundant in dscClockInterrupt()
+static void runStatusBenchmark(unsigned long commandCount) {
+  byte status05[] = {0x05, 0x81, 0x01, 0x10, 0xC7};
+
+  for (unsigned long i = 0; i < commandCount; i++) {
+    status05[1] = ((i >> 4) & 0x01) ? 0x80 : 0x81;
+    sendCommand(status05, sizeof(status05));
+    runLoop();
+  }
+
+  printf("Commands sent: %lu, decoded: %lu, Keybus time: %.1fs\n", commandCount, commandsDecoded, millis() / 1000.0);
+}
+
+
+// Updates a partition status as the panel would for the keys used by the write scenario: '*' enters the * function
+// menu, '1' in the menu enters zone bypass, and '#' exits to ready
+static void updatePartitionStatus(byte &status, byte key) {
+  if (key == 0x28) status = 0x9E;
+  else if (key == 0x05 && status == 0x9E) status = 0xA0;
+  else if (key == 0x2D) status = 0x01;
+}
+
+
+// Prints a key read from the write pin, partition 0 for alarm keys
+static void printKeypadKey(byte partition, int key) {
+  if (quiet) return;
+  printTimestamp();
+  if (partition) printf(" Keypad partition %d: 0x%02X\n", partition, key);
+  else printf(" Keypad alarm: 0x%02X\n", key);
+}
+
+
+#if defined(DSC_LATENCY_STATS)
+static void printLatencyHistogram(const char *name, const dscLatencyHistogram &histogram) {
+  printf("%s: max %lums, buckets:", name, histogram.maxLatency);
+  for (byte bucket = 0; bucket < dscLatencyBuckets; bucket++) printf(" %u", histogram.buckets[bucket]);
+  printf("\n");
+}
+#endif
+
+
+// Synthesizes the 0x05 and 0x1B status commands of a panel with 8 ready partitions while writing keys as a sketch
+// would, reading the keys written by the virtual keypad from the write pin.  Alarm keys are verified with 0x1C, and
+// the partition status responds to the keys of the bypass macro.
+static void runWriteScenario(unsigned long cycleCount) {
+  byte status05[] = {0x05, 0x81, 0x01, 0x81, 0x01, 0x81, 0x01, 0x81, 0x01};
+  byte status1B[] = {0x1B, 0x81, 0x01, 0x81, 0x01, 0x81, 0x01, 0x81, 0x01};
+  const byte verify1C[] = {0x1C};
+  const byte keyBytes[] = {2, 3, 8, 9};  // Byte of the status command written with the key of each partition
+  static const byte bypassMacro[] PROGMEM = {'*', '1', dscMacroWaitStatus, 0xA0, '0', '1', '#', dscMacroEnd};
+
+  const byte trackedWrites = 8;
+  byte writeHandles[trackedWrites] = {};
+  unsigned long writeResults[dscWriteSkipped + 1] = {};
+  unsigned long keysWritten = 0, alarmKeysWritten = 0, macrosRun = 0, macrosWritten = 0;
+  bool macroRunning = false;
+
+  for (unsigned long cycle = 0; cycle < cycleCount; cycle++) {
+
+    // Writes keys for several partitions every 8 cycles and a panic alarm key every 64 cycles
+    if (cycle % 8 == 0 || cycle % 64 == 20) {
+      byte handleIndex = 0;
+      while (handleIndex < trackedWrites && writeHandles[handleIndex] != 0) handleIndex++;
+      if (handleIndex < trackedWrites) writeHandles[handleIndex] = dsc.write(cycle % 8 ? "/2p" : "/21/32/53/64");
+    }
+
+    // Runs the bypass macro on partition 1 every 64 cycles
+    if (cycle % 64 == 40 && !macroRunning) {
+      dsc.writePartition = 1;
+      macroRunning = dsc.runMacro(bypassMacro);
+      if (macroRunning) macrosRun++;
+    }
+
+    for (byte commandIndex = 0; commandIndex < 2; commandIndex++) {
+      byte *command = commandIndex ? status1B : status05;
+      sendCommand(command, sizeof(status05));
+
+      for (byte keyIndex = 0; keyIndex < 4; keyIndex++) {
+        int key = keypadKey((keyBytes[keyIndex] - 1) * 8 + 1);
+        if (key < 0) continue;
+        keysWritten++;
+        printKeypadKey(commandIndex * 4 + keyIndex + 1, key);
+        updatePartitionStatus(command[keyIndex * 2 + 2], key);
+      }
+
+      // The panel verifies alarm keys with 0x1C, during which the virtual keypad repeats the key
+      int alarmKey = keypadKey(0);
+      if (alarmKey >= 0) {
+        alarmKeysWritten++;
+        printKeypadKey(0, alarmKey);
+      }
+      runLoop();
+
+      if (alarmKey >= 0) {
+        sendCommand(verify1C, sizeof(verify1C));
+        alarmKey = keypadKey(0);
+        if (alarmKey >= 0) {
+          alarmKeysWritten++;
+          printKeypadKey(0, alarmKey);
+        }
+        runLoop();
+      }
+    }
+
+    for (byte handleIndex = 0; handleIndex < trackedWrites; handleIndex++) {
+      if (writeHandles[handleIndex] == 0) continue;
+      byte writeStatus = dsc.writeStatus(writeHandles[handleIndex]);
+      if (writeStatus == dscWriteQueued || writeStatus == dscWriteInProgress) continue;
+      writeResults[writeStatus]++;
+      writeHandles[handleIndex] = 0;
+    }
+
+    if (macroRunning && dsc.macroStatus != dscWriteInProgress) {
+      macroRunning = false;
+      if (dsc.macroStatus == dscWriteWritten) macrosWritten++;
+    }
+  }
+
+  printf("Cycles: %lu, commands decoded: %lu, Keybus time: %.1fs\n", cycleCount, commandsDecoded, millis() / 1000.0);
+  printf("Keys written: %lu, alarm keys written: %lu (including the 0x1C repeats)\n", keysWritten, alarmKeysWritten);
+  printf("Write commands written: %lu, skipped: %lu, timed out: %lu, untracked: %lu\n", writeResults[dscWriteWritten],
+         writeResults[dscWriteSkipped], writeResults[dscWriteTimedOut], writeResults[dscWriteUnknown]);
+  printf("Macros run: %lu, completed: %lu\n", macrosRun, macrosWritten);
+
+  #if defined(DSC_LATENCY_STATS)
+  printLatencyHistogram("Write latency", dsc.writeLatency);
+  printLatencyHistogram("Alarm verify latency", dsc.alarmVerifyLatency);
+  #endif
+}
+
+
+#if defined(DSC_ISR_STATS)
+static void printInterruptTiming(const char *name, const dscInterruptTiming &timing) {
+  if (!timing.count) return;
+  printf("%s: %lu calls, min %lu, max %lu, average %.1f ns\n", name, timing.count, timing.minCycles, timing.maxCycles,
+         (double)timing.totalCycles / timing.count);
+}
+
+
+static void printInterruptStats() {
+  dscInterruptStats stats;
+  dsc.readInterruptStats(stats);
+  printInterruptTiming("dscClockInterrupt()", stats.clockInterrupt);
+  printInterruptTiming("dscDataInterrupt()", stats.dataInterrupt);
+  printf("Frames captured: %lu, redundant: %lu, buffer overflows: %lu\n", stats.framesCaptured, stats.framesRedundant,
+         stats.bufferOverflows);
+}
+#endif
+
+
+// Replays an edge trace, calling loop() after each edge
+static bool runTrace(const char *traceFile) {
+  FILE *trace = fopen(traceFile, "r");
+  if (trace == NULL) {
+    perror(traceFile);
+    return false;
+  }
+
+  char line[128];
+  unsigned long long traceStart = 0;
+  bool firstSample = true;
+  unsigned long edges = 0;
+  while (fgets(line, sizeof(line), trace) != NULL) {
+    unsigned long long sampleTime;
+    int clockLevel, dataLevel;
+    for (char *c = line; *c; c++) if (*c == ',' || *c == ';' || *c == '\t') *c = ' ';
+    if (sscanf(line, "%llu %d %d", &sampleTime, &clockLevel, &dataLevel) != 3) continue;
+
+    if (firstSample) {
+      traceStart = sampleTime;
+      firstSample = false;
+    }
+    unsigned long long traceTime = sampleTime - traceStart;
+    if (traceTime > micros()) nativeAdvance(traceTime - micros());
+
+    nativeSetPin(dscReadPin, dataLevel);
+    nativeSetPin(dscClockPin, clockLevel);
+    edges++;
+    runLoop();
+  }
+  fclose(trace);
+
+  // Holds the clock to complete the last command
+  nativeAdvance(commandGap);
+  nativeSetPin(dscClockPin, !digitalRead(dscClockPin));
+  runLoop();
+
+  printf("Edges: %lu, commands decoded: %lu, Keybus time: %.1fs\n", edges, commandsDecoded, millis() / 1000.0);
+  if (commandsDecoded) printf("loop() decode only: %.0f ns/command\n", (double)decodeNanoseconds / commandsDecoded);
+  return true;
+}
+
+
+#if defined(DSC_CAPTURE)
+// Replays a binary capture through replayPanel() and replayModule(), advancing the virtual clock to the time of each
+// panel command, and prints the replay speed and the processing cost of each panel command
+static bool runReplay(const char *captureFile) {
+  FILE *capture = fopen(captureFile, "rb");
+  if (capture == NULL) {
+    perror(captureFile);
+    return false;
+  }
+
+  byte header[6];
+  if (fread(header, 1, sizeof(header), capture) != sizeof(header) || memcmp(header, "DSCK", 4) != 0 ||
+      header[4] != dscCaptureVersion || header[5] > dscReadSize) {
+    fprintf(stderr, "%s: not a version %d Keybus capture\n", captureFile, dscCaptureVersion);
+    fclose(capture);
+    return false;
+  }
+  byte captureReadSize = header[5];
+
+  static unsigned long commandCount[256];
+  static unsigned long long commandNanoseconds[256];
+  unsigned long panelRecords = 0, moduleRecords = 0;
+  unsigned long captureTime = 0, firstTime = 0;
+  bool truncated = false;
+
+  unsigned long long startTime = hostNanoseconds();
+  int recordType;
+  while ((recordType = fgetc(capture)) != EOF) {
+    byte record[6];
+    byte data[dscReadSize];
+
+    if (recordType == dscCapturePanel) {
+      if (fread(record, 1, 2, capture) != 2) { truncated = true; break; }
+      unsigned int timeDelta = record[0] | (record[1] << 8);
+      if (timeDelta == 0xFFFF) {
+        if (fread(record, 1, 4, capture) != 4) { truncated = true; break; }
+        captureTime = record[0] | (record[1] << 8) | ((unsigned long)record[2] << 16) | ((unsigned long)record[3] << 24);
+      }
+      else captureTime += timeDelta;
+    }
+    else if (recordType == dscCaptureModule) {
+      if (fread(record, 1, 2, capture) != 2) { truncated = true; break; }
+    }
+    else {
+      fprintf(stderr, "%s: unknown record type 0x%02X\n", captureFile, recordType);
+      truncated = true;
+      break;
+    }
+
+    byte counts[2];
+    if (fread(counts, 1, 2, capture) != 2) { truncated = true; break; }
+    byte recordBytes = counts[0] < captureReadSize ? counts[0] + 1 : captureReadSize;
+    if (fread(data, 1, recordBytes, capture) != recordBytes) { truncated = true; break; }
+
+    if (recordType == dscCapturePanel) {
+      if (panelRecords++ == 0) firstTime = captureTime;
+      if (captureTime * 1000ULL > micros()) nativeAdvance(captureTime * 1000ULL - micros());
+
+      unsigned long long commandStart = hostNanoseconds();
+      bool decoded = dsc.replayPanel(data, counts[0], counts[1], captureTime);
+      commandNanoseconds[data[0]] += hostNanoseconds() - commandStart;
+      commandCount[data[0]]++;
+
+      if (decoded) {
+        commandsDecoded++;
+        if (dsc.statusChanged) dsc.statusChanged = false;
+        if (!quiet) printPanel();
+      }
+    }
+    else {
+      moduleRecords++;
+      if (dsc.replayModule(record[0], record[1], data, counts[0], counts[1]) && !quiet) printModule();
+    }
+  }
+  unsigned long long totalNanoseconds = hostNanoseconds() - startTime;
+  fclose(capture);
+
+  if (truncated) fprintf(stderr, "%s: capture ends with an incomplete record\n", captureFile);
+
+  double captureSeconds = (captureTime - firstTime) / 1000.0;
+  printf("Panel records: %lu, module records: %lu, decoded: %lu\n", panelRecords, moduleRecords, commandsDecoded);
+  printf("Partition status decodes skipped: %lu\n", dsc.partitionStatusSkipped);
+  printf("Keybus time: %.1fs, replay time: %.3fs", captureSeconds, totalNanoseconds / 1e9);
+  if (totalNanoseconds) printf(" (%.0fx real-time)", captureSeconds * 1e9 / totalNanoseconds);
+  printf("\n\nCommand   Count      ns/command\n");
+  for (int cmd = 0; cmd < 256; cmd++) {
+    if (!commandCount[cmd]) continue;
+    printf("  0x%02X  %9lu  %10.0f\n", cmd, commandCount[cmd], (double)commandNanoseconds[cmd] / commandCount[cmd]);
+  }
+  return !truncated;
+}
+#endif
+
+
+int main(int argc, char *argv[]) {
+  unsigned long benchCommands = 0;
+  unsigned long statusCommands = 0;
+  unsigned long writeCycles = 0;
+  const char *traceFile = NULL;
+  const char *captureFile = NULL;
+  const char *replayFile = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-q") == 0) quiet = true;
+    else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) benchCommands = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--status") == 0 && i + 1 < argc) statusCommands = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--write") == 0 && i + 1 < argc) writeCycles = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) captureFile = argv[++i];
+    else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) replayFile = argv[++i];
+    else traceFile = argv[i];
+  }
+
+  if (!benchCommands && !statusCommands && !writeCycles && traceFile == NULL && replayFile == NULL) {
+    fprintf(stderr, "Usage: %s [-q] [-w capture.dsc] trace.txt | --bench commands | --status commands | --write cycles | "
+                    "--replay capture.dsc\n", argv[0]);
+    return 2;
+  }
+
+  #if defined(DSC_CAPTURE)
+  FILE *capture = NULL;
+  FilePrint *captureOutput = NULL;
+  if (captureFile != NULL) {
+    capture = fopen(captureFile, "wb");
+    if (capture == NULL) {
+      perror(captureFile);
+      return 1;
+    }
+    captureOutput = new FilePrint(capture);
+  }
+  #else
+  if (captureFile != NULL || replayFile != NULL) {
+    fprintf(stderr, "Binary captures require building with -D DSC_CAPTURE\n");
+    return 2;
+  }
+  #endif
+
+  // Keybus idles with the clock and data lines high
+  nativeSetPin(dscClockPin, HIGH);
+  nativeSetPin(dscReadPin, HIGH);
+
+  dsc.processModuleData = true;
+  dsc.begin();
+
+  #if defined(DSC_CAPTURE)
+  if (replayFile != NULL) return runReplay(replayFile) ? 0 : 1;
+  if (captureOutput != NULL) dsc.captureBegin(*captureOutput);
+  #endif
+
+  bool traceValid = true;
+  if (benchCommands || statusCommands || writeCycles) {
+
+    // Ends the idle period so that the first command starts on the next rising edge
+    nativeAdvance(commandGap);
+    nativeSetPin(dscClockPin, LOW);
+    nativeAdvance(clockHalfPeriod);
+
+    if (writeCycles) runWriteScenario(writeCycles);
+    else {
+      quiet = true;
+      if (benchCommands) runBenchmark(benchCommands);
+      else runStatusBenchmark(statusCommands);
+    }
+  }
+  else traceValid = runTrace(traceFile);
+
+  #if defined(DSC_ISR_STATS)
+  printInterruptStats();
+  #endif
+
+  #if defined(DSC_CAPTURE)
+  if (capture != NULL) {
+    dsc.captureEnd();
+    fclose(capture);
+    delete captureOutput;
+  }
+  #endif
+
+  return traceValid ? 0 : 1;
+}
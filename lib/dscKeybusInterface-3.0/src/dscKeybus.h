@@ -22,23 +22,321 @@
 
 #include <Arduino.h>
 
+// Capacity can be set at build time in platformio.ini or the compiler flags, otherwise the platform defaults are used:
+//   -D DSC_PARTITIONS=n   Maximum number of partitions (1-8) - requires 8 bytes of memory per partition
+//   -D DSC_ZONES=n        Maximum number of zone groups (1-8), 8 zones per group - requires 6 bytes of memory per zone group
+//   -D DSC_BUFFER_SIZE=n  Number of maximum length commands to buffer if the sketch is busy, shorter commands are packed to fit more - requires dscReadSize + 4 bytes of memory per command
+//   -D DSC_READ_SIZE=n    Maximum bytes of a Keybus command (14-32)
+//
+// Zones above DSC_ZONES * 8 and partitions above DSC_PARTITIONS are ignored, and the decoding of commands that only
+// carry status for them is compiled out.
+#if !defined(DSC_PARTITIONS)
 #if defined(__AVR__)
-const byte dscPartitions = 1;   // Maximum number of partitions - requires 19 bytes of memory per partition
-const byte dscZones = 1;        // Maximum number of zone groups, 8 zones per group - requires 6 bytes of memory per zone group
-const byte dscBufferSize = 10;  // Number of commands to buffer if the sketch is busy - requires dscReadSize + 2 bytes of memory per command
-const byte dscReadSize = 16;    // Maximum bytes of a Keybus command
+#define DSC_PARTITIONS 1
+#else
+#define DSC_PARTITIONS 8
+#endif
+#endif
+
+#if !defined(DSC_ZONES)
+#if defined(__AVR__)
+#define DSC_ZONES 1
+#else
+#define DSC_ZONES 8
+#endif
+#endif
+
+#if !defined(DSC_BUFFER_SIZE)
+#if defined(__AVR__)
+#define DSC_BUFFER_SIZE 10
+#else
+#define DSC_BUFFER_SIZE 50
+#endif
+#endif
+
+#if !defined(DSC_READ_SIZE)
+#define DSC_READ_SIZE 16
+#endif
+
+static_assert(DSC_PARTITIONS >= 1 && DSC_PARTITIONS <= 8, "DSC_PARTITIONS must be 1-8");
+static_assert(DSC_ZONES >= 1 && DSC_ZONES <= 8, "DSC_ZONES must be 1-8 zone groups");
+static_assert(DSC_BUFFER_SIZE >= 1 && DSC_BUFFER_SIZE <= 255, "DSC_BUFFER_SIZE must be 1-255");
+static_assert(DSC_READ_SIZE >= 14 && DSC_READ_SIZE <= 32, "DSC_READ_SIZE must be 14-32");
+
+#if defined(__AVR__)
+const byte dscPartitions = DSC_PARTITIONS;
+const byte dscZones = DSC_ZONES;
+const byte dscBufferSize = DSC_BUFFER_SIZE;
+const byte dscReadSize = DSC_READ_SIZE;
+const byte dscModuleBufferSize = 3;  // Number of maximum length keypad and module responses to buffer if processModuleData is set - requires dscReadSize + 4 bytes of memory per response
+const byte dscStatusEventBufferSize = 8;  // Number of status events to buffer until read by nextStatusEvent() - requires 3 bytes of memory per event
+const byte dscPanelEventBufferSize = 4;   // Number of panel events to log until read by nextPanelEvent() - requires 8 bytes of memory per event
+const byte dscWriteBufferSize = 24;       // Number of virtual keypad keys to buffer until written - requires 1 byte of memory per key
+const byte dscWriteCommandSize = 2;       // Number of write() commands to track for writeStatus() - requires 19 bytes of memory per command
+typedef byte dscBufferIndex;    // Panel buffer indices are single bytes so that the interrupt and loop() can access them atomically
 #elif defined(ESP8266)
-const byte dscPartitions = 8;
-const byte dscZones = 8;
-const byte dscBufferSize = 50;
-const byte dscReadSize = 16;
+const byte dscPartitions = DSC_PARTITIONS;
+const byte dscZones = DSC_ZONES;
+const byte dscBufferSize = DSC_BUFFER_SIZE;
+const byte dscReadSize = DSC_READ_SIZE;
+const byte dscModuleBufferSize = 20;
+const byte dscStatusEventBufferSize = 32;
+const byte dscPanelEventBufferSize = 16;
+const byte dscWriteBufferSize = 64;
+const byte dscWriteCommandSize = 8;
+typedef unsigned int dscBufferIndex;
 #elif defined(ESP32)
-const byte dscPartitions = 8;
-const byte dscZones = 8;
-const DRAM_ATTR byte dscBufferSize = 50;
-const DRAM_ATTR byte dscReadSize = 16;
+const byte dscPartitions = DSC_PARTITIONS;
+const byte dscZones = DSC_ZONES;
+const DRAM_ATTR byte dscBufferSize = DSC_BUFFER_SIZE;
+const DRAM_ATTR byte dscReadSize = DSC_READ_SIZE;
+const DRAM_ATTR byte dscModuleBufferSize = 20;
+const byte dscStatusEventBufferSize = 32;
+const byte dscPanelEventBufferSize = 16;
+const byte dscWriteBufferSize = 64;
+const byte dscWriteCommandSize = 8;
+typedef unsigned int dscBufferIndex;
+#elif defined(DSC_NATIVE)  // Host build with the Arduino shim in extras/native
+const byte dscPartitions = DSC_PARTITIONS;
+const byte dscZones = DSC_ZONES;
+const byte dscBufferSize = DSC_BUFFER_SIZE;
+const byte dscReadSize = DSC_READ_SIZE;
+const byte dscModuleBufferSize = 20;
+const byte dscStatusEventBufferSize = 32;
+const byte dscPanelEventBufferSize = 16;
+const byte dscWriteBufferSize = 64;
+const byte dscWriteCommandSize = 8;
+typedef unsigned int dscBufferIndex;
 #endif
 
+// Extended status commands 0xE6 and 0xEB are only decoded if partitions 3-8 or zones 33-64 are configured
+const bool dscExtendedStatus = dscPartitions > 2 || dscZones > 4;
+
+// Panel buffer size in bytes - each command is stored as a record of byte count, bit count, capture time, and the
+// captured bytes
+const dscBufferIndex dscBufferBytes = dscBufferSize * (dscReadSize + 4);
+static_assert(dscBufferSize * (dscReadSize + 4) <= (dscBufferIndex)-1, "dscBufferSize * (dscReadSize + 4) exceeds the panel buffer index range");
+
+// Keypad and module buffer size in bytes - each response is stored as a record of panel command, panel subcommand,
+// byte count, bit count, and the captured bytes
+const dscBufferIndex dscModuleBufferBytes = dscModuleBufferSize * (dscReadSize + 4);
+static_assert(dscModuleBufferSize * (dscReadSize + 4) <= (dscBufferIndex)-1, "dscModuleBufferSize * (dscReadSize + 4) exceeds the module buffer index range");
+
+#if defined(DSC_ISR_STATS)
+// Interrupt timing in CPU cycles, the average is totalCycles / count
+struct dscInterruptTiming {
+  unsigned long count;
+  unsigned long minCycles, maxCycles, totalCycles;
+};
+
+// Interrupt statistics enabled with -D DSC_ISR_STATS
+struct dscInterruptStats {
+  dscInterruptTiming clockInterrupt;  // dscClockInterrupt()
+  dscInterruptTiming dataInterrupt;   // dscDataInterrupt()
+  unsigned long framesCaptured;       // Commands stored in the panel buffer
+  unsigned long framesRedundant;      // Status commands skipped as redundant
+  unsigned long bufferOverflows;      // Commands dropped with the panel buffer full
+};
+#endif
+
+#if defined(DSC_LATENCY_STATS)
+// Latency histogram enabled with -D DSC_LATENCY_STATS, bucket 0 counts latencies of 0ms and bucket n counts
+// latencies of 2^(n-1) to 2^n - 1 ms, with the last bucket counting all longer latencies
+const byte dscLatencyBuckets = 12;
+
+struct dscLatencyHistogram {
+  unsigned int buckets[dscLatencyBuckets];
+  unsigned long maxLatency;
+  void record(unsigned long latency);
+  void reset();
+};
+#endif
+
+#if defined(DSC_CAPTURE)
+// Binary capture format enabled with -D DSC_CAPTURE, written by captureBegin() and replayed by replayPanel() and
+// replayModule().  Multi-byte values are little-endian.
+//
+//   Header: 'D' 'S' 'C' 'K', version, dscReadSize
+//   Panel record: dscCapturePanel, time delta in ms from the previous panel record (2 bytes, 0xFFFF is followed by
+//                 the absolute panelTime in 4 bytes), byte count, bit count, captured bytes
+//   Module record: dscCaptureModule, panel command, panel subcommand, byte count, bit count, captured bytes
+//
+// The captured bytes of each record are the byte count + 1 (to include trailing bits), up to dscReadSize.
+const byte dscCaptureVersion = 1;
+const byte dscCapturePanel = 0x01;
+const byte dscCaptureModule = 0x02;
+#endif
+
+// Status events read by nextStatusEvent(), queued as each status changes along with its changed flag.  The index is
+// the partition index (0-7) for partition events, or the zone (1-64) or PGM output (1-14) number.  The value is the new
+// status: 1 or 0, or the access code or exit state.
+struct dscStatusEvent {
+  byte type, index, value;
+};
+
+const byte dscEventResync = 0x00;          // Events were dropped with the buffer full or by resetStatus() - read the current status of all components
+const byte dscEventKeybus = 0x01;          // keybusConnected
+const byte dscEventTrouble = 0x02;         // trouble
+const byte dscEventPower = 0x03;           // powerTrouble
+const byte dscEventBattery = 0x04;         // batteryTrouble
+const byte dscEventKeypadFireAlarm = 0x05;
+const byte dscEventKeypadAuxAlarm = 0x06;
+const byte dscEventKeypadPanicAlarm = 0x07;
+const byte dscEventReady = 0x08;           // ready[index]
+const byte dscEventDisabled = 0x09;        // disabled[index]
+const byte dscEventArmed = 0x0A;           // armed[index], with armedStay[], armedAway[], and noEntryDelay[] set for the armed mode
+const byte dscEventExitDelay = 0x0B;       // exitDelay[index]
+const byte dscEventExitState = 0x0C;       // exitState[index]
+const byte dscEventEntryDelay = 0x0D;      // entryDelay[index]
+const byte dscEventAlarm = 0x0E;           // alarm[index]
+const byte dscEventFire = 0x0F;            // fire[index]
+const byte dscEventAccessCode = 0x10;      // accessCode[index]
+const byte dscEventZone = 0x11;            // openZones[] bit of zone index
+const byte dscEventAlarmZone = 0x12;       // alarmZones[] bit of zone index
+const byte dscEventPgmOutput = 0x13;       // pgmOutputs[] bit of PGM output index
+const byte dscEventTypes = 0x14;
+
+// Panel events read by nextPanelEvent(), logged from the timestamped status messages of panel commands 0xA5 and 0xEB.
+// The panel sends these as events occur: arming and disarming by access code, zone alarms, troubles, etc.  The event
+// class is the set of status messages and the argument is the status message within the set, as printed by
+// printPanelStatus0() ... printPanelStatus1B() in dscKeybusPrintData.cpp.
+struct dscPanelEvent {
+  byte year;        // Years since 1900
+  byte month, day, hour, minute;
+  byte partition;   // Partition number 1-8, or 0 for system events
+  byte eventClass;  // Status message set: 0x00-0x03 for 0xA5, 0x00-0x1B for 0xEB
+  byte argument;    // Status message
+};
+
+// Virtual keypad write status returned by writeStatus() for the handle returned by write()
+const byte dscWriteUnknown = 0;     // Invalid handle, or the command is no longer tracked
+const byte dscWriteQueued = 1;      // Keys are waiting in the write buffer
+const byte dscWriteInProgress = 2;  // The first key has been passed to dscClockInterrupt()
+const byte dscWriteWritten = 3;     // All keys have been written to the Keybus
+const byte dscWriteTimedOut = 4;    // The keys were not written within dscWriteTimeout, the remaining keys are dropped
+const byte dscWriteSkipped = 5;     // Keys were skipped as their partition is disabled or above dscPartitions
+const unsigned long dscWriteTimeout = 10000;  // Milliseconds from write() until a command is reported as timed out
+
+// Write buffer entries, with keys stored as 0x00-0x7F and partition selections as 0x81-0x88
+const byte dscWriteKeyWritten = 0x80;  // Key written to the Keybus, invalid, or dropped
+const byte dscWriteKeySkipped = 0x90;  // Key for a disabled partition or a partition above dscPartitions
+const byte dscWriteKeyStarted = 0xC0;  // Key passed to dscClockInterrupt()
+
+// Write command tracked by write(), read with writeCommand().  Keys are counted by their position in the sequence of
+// keys written to the write buffer, including partition selections.
+struct dscWriteCommand {
+  byte handle;                // Handle returned by write(), 0 if unused
+  byte status;                // dscWriteQueued ... dscWriteSkipped
+  uint16_t firstKey, endKey;  // Sequence of the first key and the key following the last key of the command
+  unsigned long queuedTime;   // millis() when the keys were written to the write buffer
+  unsigned long startTime;    // millis() when the first key was passed to dscClockInterrupt()
+  unsigned long endTime;      // millis() when the last key was written to the Keybus or the command timed out
+  bool keysSkipped;           // Set when a key is skipped, the command then ends as dscWriteSkipped
+};
+
+// Keypad macro instructions for runMacro().  A macro is a byte array in PROGMEM of keys and instructions ending with
+// dscMacroEnd: keys accepted by write() are written to the partition, and the instructions are followed by their
+// argument byte if any.  Instructions wait until the preceding keys have been written to the Keybus.
+//   Bypass zone 3:  const byte bypassMacro[] PROGMEM = {'*', '1', dscMacroWaitStatus, 0xA0, '0', '3', '#', dscMacroEnd};
+const byte dscMacroEnd = 0x00;
+const byte dscMacroWaitStatus = 0x01;  // Waits for the partition status in the argument, for example 0x9E: "Enter * function key"
+const byte dscMacroWaitPrompt = 0x02;  // Waits for the panel to request an access code and writes the access code set in runMacro()
+const byte dscMacroDelay = 0x03;       // Waits for the argument * 10ms
+const byte dscMacroPartition = 0x04;   // Writes the following keys to the partition number in the argument
+const unsigned long dscMacroTimeout = 10000;  // Milliseconds to wait for keys, a status, or a prompt until the macro stops
+
+// Status handler registered with onStatusChange(), called with the event index and value
+typedef void (*dscStatusHandler)(byte index, byte value);
+
+// Partition status packed in dscPartitionState::flags
+const byte dscReadyFlag = 0x01;
+const byte dscArmedFlag = 0x02;
+const byte dscArmedStayFlag = 0x04;
+const byte dscArmedAwayFlag = 0x08;
+const byte dscExitDelayFlag = 0x10;
+const byte dscEntryDelayFlag = 0x20;
+const byte dscAlarmFlag = 0x40;
+const byte dscNoEntryDelayFlag = 0x80;
+const byte dscArmedFlags = dscArmedFlag | dscArmedStayFlag | dscArmedAwayFlag;
+
+// Partition changed flags packed in dscPartitionState::changed
+const byte dscReadyChanged = 0x01;
+const byte dscArmedChanged = 0x02;
+const byte dscExitDelayChanged = 0x04;
+const byte dscEntryDelayChanged = 0x08;
+const byte dscAlarmChanged = 0x10;
+const byte dscFireChanged = 0x20;
+const byte dscDisabledChanged = 0x40;
+const byte dscAccessCodeChanged = 0x80;
+
+// Remaining partition status packed in dscPartitionState::other
+const byte dscFireFlag = 0x01;
+const byte dscDisabledFlag = 0x02;
+const byte dscExitStateChanged = 0x04;
+const byte dscWriteAccessCodeFlag = 0x08;  // Access code is sent when requested by the panel after a write
+const byte dscPreviousExitState = 0x30;    // exitState at the last exit delay, 2 bits
+
+// Status of a partition in 7 bytes, so that it can be copied or compared in one operation
+struct dscPartitionState {
+  byte flags;       // Ready, armed, exit/entry delay, alarm, and no entry delay
+  byte changed;     // Changed flags for the sketch to clear
+  byte other;       // Fire, disabled, exit state changed, and internal status
+  byte exitState;
+  byte accessCode;
+  byte lights;      // Status lights of the last status command
+  byte status;      // Status message of the last status command
+};
+static_assert(sizeof(dscPartitionState) == 7, "dscPartitionState is not packed");
+
+// A single partition status flag, read and set as a bool
+class dscPartitionFlag {
+  public:
+    dscPartitionFlag(byte &setFlags, byte setMask) : flags(setFlags), mask(setMask) {}
+    operator bool() const { return flags & mask; }
+    dscPartitionFlag &operator=(bool value) {
+      if (value) flags |= mask;
+      else flags &= ~mask;
+      return *this;
+    }
+    dscPartitionFlag &operator=(const dscPartitionFlag &flag) { return *this = (bool)flag; }
+
+  private:
+    byte &flags;
+    byte mask;
+};
+
+// Accessors for the status of each partition in dscKeybusInterface::partitionState[], indexed by partition like the
+// previous per-partition arrays: ready[partition], exitState[partition], etc.  These have no storage of their own.
+template <byte dscPartitionState::*field, byte mask>
+struct dscPartitionFlags {
+  dscPartitionFlag operator[](byte partitionIndex) const;
+};
+
+template <byte dscPartitionState::*field>
+struct dscPartitionBytes {
+  byte &operator[](byte partitionIndex) const;
+};
+
+// System status packed in dscStatusSnapshot::system
+const byte dscSnapshotKeybus = 0x01;            // keybusConnected
+const byte dscSnapshotTrouble = 0x02;           // trouble
+const byte dscSnapshotPower = 0x04;             // powerTrouble
+const byte dscSnapshotBattery = 0x08;           // batteryTrouble
+const byte dscSnapshotKeypadFireAlarm = 0x10;   // keypadFireAlarm
+const byte dscSnapshotKeypadAuxAlarm = 0x20;    // keypadAuxAlarm
+const byte dscSnapshotKeypadPanicAlarm = 0x40;  // keypadPanicAlarm
+
+// Status of all components after a processed Keybus command, read with statusSnapshot().  The partition changed flags
+// and internal status are cleared, so the snapshot only changes with the status itself.
+struct dscStatusSnapshot {
+  byte system;
+  dscPartitionState partitions[dscPartitions];
+  byte openZones[dscZones], alarmZones[dscZones];
+  byte pgmOutputs[2];
+  uint16_t sequence;   // Incremented with each snapshot, a reader can skip a snapshot with an unchanged sequence
+  unsigned long time;  // panelTime of the Keybus command that changed the status
+};
+
 // Exit delay target states
 #define DSC_EXIT_STAY 1
 #define DSC_EXIT_AWAY 2
@@ -50,6 +348,14 @@ class dscKeybusInterface {
   public:
 
     // Initializes writes as disabled by default
+    //
+    // On Arduino/AVR, -D DSC_TIMER1_CAPTURE runs Timer1 freely to timestamp clock changes and schedules data reads
+    // with an output compare instead of reloading the timer on each clock change.  Timer1 output compare B remains
+    // available to the sketch in this mode.
+    //
+    // On Arduino Uno/Nano (ATmega328P/168), the pins can also be fixed at build time with -D DSC_CLOCK_PIN=n,
+    // -D DSC_READ_PIN=n, and -D DSC_WRITE_PIN=n to compile the interrupts to direct port access - these must match the
+    // pins set here, begin() prints an error and does not start the interface if they differ.
     dscKeybusInterface(byte setClockPin, byte setReadPin, byte setWritePin = 255);
 
     // Interface control
@@ -58,21 +364,28 @@ class dscKeybusInterface {
     void stop();                                      // Disables the clock hardware interrupt and data timer interrupt
     void resetStatus();                               // Resets the state of all status components as changed for sketches to get the current status
 
-    // Writes a single key - nonblocking unless a previous write is in progress
-    void write(const char receivedKey);
+    // Writes a single key - nonblocking, the key is copied to the write buffer and written by loop() as the panel
+    // accepts keys.  Returns a handle for writeStatus(), or 0 if the write buffer is full.
+    byte write(const char receivedKey);
 
-    // Writes multiple keys from a char array
-    //
-    // By default, this is nonblocking unless there is a previous write in progress - in this case, the sketch must keep the char
-    // array defined at least until the write is complete.
+    // Writes multiple keys from a char array - nonblocking, the keys are copied to the write buffer so the char array
+    // can be ephemeral.  Returns a handle for writeStatus(), or 0 without writing any keys if the write buffer does not
+    // have room for all of the keys plus one, used to select the partition.
     //
-    // If the char array is ephemeral, check if the write is complete by checking writeReady or set blockingWrite to true to
-    // block until the write is complete.
-    void write(const char * receivedKeys, bool blockingWrite = false);
+    // Set blockingWrite to true to block until all keys are written or the command times out, for keys that may not
+    // fit in the write buffer.
+    byte write(const char * receivedKeys, bool blockingWrite = false);
 
     // Write control
-    static byte writePartition;                       // Set to a partition number for virtual keypad
-    bool writeReady;                                  // True if the library is ready to write a key
+    static byte writePartition;                       // Set to a partition number for virtual keypad, applies to the keys written after it is set
+    bool writeReady;                                  // True if the library is ready to write a key, with no keys waiting to be written
+
+    // Returns the status of the keys written with a handle from write(): queued, in progress, written, timed out, or
+    // skipped for a disabled partition.  The most recent dscWriteCommandSize commands are tracked, older handles return
+    // dscWriteUnknown.  writeCommand() returns the tracked command with its timestamps, or NULL - the command-to-bus
+    // latency of a written command is endTime - queuedTime.
+    byte writeStatus(byte handle);
+    const dscWriteCommand *writeCommand(byte handle);
 
     // Prints output to the stream interface set in begin()
     void printPanelBinary(bool printSpaces = true);   // Includes spaces between bytes by default
@@ -92,35 +405,119 @@ class dscKeybusInterface {
     int year;
 
     // Sets panel time, the year can be sent as either 2 or 4 digits, returns true if the panel is ready to set the time
+    // and the keys fit in the write buffer
     bool setTime(unsigned int year, byte month, byte day, byte hour, byte minute, const char* accessCode, byte timePartition = 1);
 
+    // Runs a keypad macro stored in PROGMEM, starting with the partition in writePartition - nonblocking, loop() writes
+    // the keys and runs the instructions as the panel responds.  dscMacroWaitPrompt writes the access code, which must
+    // remain valid while the macro runs - access code prompts for the macro partition are then not reported to the
+    // sketch with accessCodePrompt.  If the access code is NULL, the prompt is left to the sketch.  Returns false if a
+    // macro is already running.
+    //
+    // macroStatus is dscWriteInProgress while the macro runs, dscWriteWritten once it completes, and dscWriteTimedOut
+    // if a wait exceeds dscMacroTimeout.  stopMacro() stops the macro and drops its keys that have not been written,
+    // setting macroStatus to dscWriteUnknown - the keys are also dropped if the macro times out.
+    bool runMacro(const byte *macro, const char *accessCode = NULL);
+    void stopMacro();
+    byte macroStatus;
+
     // Status tracking
     bool statusChanged;                   // True after any status change
     bool pauseStatus;                     // Prevent status from showing as changed, set in sketch to control when to update status
     bool keybusConnected, keybusChanged;  // True if data is detected on the Keybus
-    byte accessCode[dscPartitions];
-    bool accessCodeChanged[dscPartitions];
     bool accessCodePrompt;                // True if the panel is requesting an access code
     bool decimalInput;                    // True if the panel is requesting 3 digit input (for 0x6E readout)
     bool trouble, troubleChanged;
     bool powerTrouble, powerChanged;
     bool batteryTrouble, batteryChanged;
     bool keypadFireAlarm, keypadAuxAlarm, keypadPanicAlarm;
-    bool ready[dscPartitions], readyChanged[dscPartitions];
-    bool disabled[dscPartitions], disabledChanged[dscPartitions];
-    bool armed[dscPartitions], armedAway[dscPartitions], armedStay[dscPartitions];
-    bool noEntryDelay[dscPartitions], armedChanged[dscPartitions];
-    bool alarm[dscPartitions], alarmChanged[dscPartitions];
-    bool exitDelay[dscPartitions], exitDelayChanged[dscPartitions];
-    byte exitState[dscPartitions], exitStateChanged[dscPartitions];
-    bool entryDelay[dscPartitions], entryDelayChanged[dscPartitions];
-    bool fire[dscPartitions], fireChanged[dscPartitions];
+
+    // Partition status is stored in partitionState[] using a packed record per partition, and can be accessed per
+    // partition as ready[partition], armedChanged[partition], etc.  The accessors share a single byte.
+    static dscPartitionState partitionState[dscPartitions];
+    union {
+      dscPartitionBytes<&dscPartitionState::accessCode> accessCode;
+      dscPartitionFlags<&dscPartitionState::changed, dscAccessCodeChanged> accessCodeChanged;
+      dscPartitionFlags<&dscPartitionState::flags, dscReadyFlag> ready;
+      dscPartitionFlags<&dscPartitionState::changed, dscReadyChanged> readyChanged;
+      dscPartitionFlags<&dscPartitionState::other, dscDisabledFlag> disabled;
+      dscPartitionFlags<&dscPartitionState::changed, dscDisabledChanged> disabledChanged;
+      dscPartitionFlags<&dscPartitionState::flags, dscArmedFlag> armed;
+      dscPartitionFlags<&dscPartitionState::flags, dscArmedAwayFlag> armedAway;
+      dscPartitionFlags<&dscPartitionState::flags, dscArmedStayFlag> armedStay;
+      dscPartitionFlags<&dscPartitionState::flags, dscNoEntryDelayFlag> noEntryDelay;
+      dscPartitionFlags<&dscPartitionState::changed, dscArmedChanged> armedChanged;
+      dscPartitionFlags<&dscPartitionState::flags, dscAlarmFlag> alarm;
+      dscPartitionFlags<&dscPartitionState::changed, dscAlarmChanged> alarmChanged;
+      dscPartitionFlags<&dscPartitionState::flags, dscExitDelayFlag> exitDelay;
+      dscPartitionFlags<&dscPartitionState::changed, dscExitDelayChanged> exitDelayChanged;
+      dscPartitionBytes<&dscPartitionState::exitState> exitState;
+      dscPartitionFlags<&dscPartitionState::other, dscExitStateChanged> exitStateChanged;
+      dscPartitionFlags<&dscPartitionState::flags, dscEntryDelayFlag> entryDelay;
+      dscPartitionFlags<&dscPartitionState::changed, dscEntryDelayChanged> entryDelayChanged;
+      dscPartitionFlags<&dscPartitionState::other, dscFireFlag> fire;
+      dscPartitionFlags<&dscPartitionState::changed, dscFireChanged> fireChanged;
+
+      // status[] and lights[] store the current status message and LED state for each partition.  These can be
+      // accessed directly in the sketch to get data that is not already tracked in the library.  See
+      // printPanelMessages() and printPanelLights() in dscKeybusPrintData.cpp to see how this data translates to the
+      // status message and LED status.
+      dscPartitionBytes<&dscPartitionState::status> status;
+      dscPartitionBytes<&dscPartitionState::lights> lights;
+    };
+
     bool openZonesStatusChanged;
     byte openZones[dscZones], openZonesChanged[dscZones];    // Zone status is stored in an array using 1 bit per zone, up to 64 zones
     bool alarmZonesStatusChanged;
     byte alarmZones[dscZones], alarmZonesChanged[dscZones];  // Zone alarm status is stored in an array using 1 bit per zone, up to 64 zones
     bool pgmOutputsStatusChanged;
     byte pgmOutputs[2], pgmOutputsChanged[2];
+
+    // Return the next zone (1-64) or PGM output (1-14) at or after the given number that has its changed flag set,
+    // clearing the flag, or 0 if there are no more changes.  These only check the set bits of openZonesChanged[],
+    // alarmZonesChanged[], and pgmOutputsChanged[]:
+    //   for (byte zone = dsc.nextChangedZone(); zone; zone = dsc.nextChangedZone(zone + 1)) { ... }
+    byte nextChangedZone(byte fromZone = 1);
+    byte nextChangedAlarmZone(byte fromZone = 1);
+    byte nextChangedPgmOutput(byte fromPgm = 1);
+
+    // Reads the oldest status event, returns false if there are no events.  Events are queued in order as the status
+    // changes, so the sketch only handles what changed instead of checking every changed flag:
+    //   dscStatusEvent event;
+    //   while (dsc.nextStatusEvent(event)) { ... }
+    //
+    // If the event buffer fills, the queued events are dropped and the next event is dscEventResync - the sketch
+    // then reads the current status of all components.  peekStatusEvent() reads the oldest event without removing it,
+    // to retry handling the event later.
+    bool nextStatusEvent(dscStatusEvent &event);
+    bool peekStatusEvent(dscStatusEvent &event);
+
+    // Reads the oldest logged panel event, returns false if there are no events.  If the log fills before it is read,
+    // the oldest events are overwritten and panelEventOverflow is set - set it to false in the sketch after handling it.
+    // peekPanelEvent() reads the oldest event without removing it.
+    bool nextPanelEvent(dscPanelEvent &event);
+    bool peekPanelEvent(dscPanelEvent &event);
+    bool panelEventOverflow;
+
+    // Returns the status of all components as of the last processed Keybus command.  The status is copied to a second
+    // buffer when it changes and the buffers are swapped, so the snapshot does not change while it is read even if
+    // loop() processes another command, for example from a blocking write().  The snapshot is reused after loop()
+    // processes a second status change - check that the sequence is unchanged after reading if this is possible:
+    //   const dscStatusSnapshot *snapshot = dsc.statusSnapshot();
+    //   if (snapshot->sequence != previousSequence) { ... }
+    //
+    // Status handlers are called before the snapshot of the command is taken, and read the current status instead.
+    const dscStatusSnapshot *statusSnapshot() const { return &snapshots[snapshotIndex]; }
+
+    // Registers a handler for a status event type, or NULL to remove it.  The handler is called by loop() as the
+    // status changes instead of queuing the event, so the sketch can act on it in the same pass as the Keybus command.
+    // The index and value are as described for dscStatusEvent - other status may not be updated yet when the handler
+    // is called, and the handler must not call loop().
+    void onStatusChange(byte eventType, dscStatusHandler handler);
+    void onArmedChange(dscStatusHandler handler);    // Partition index, armed
+    void onZoneChange(dscStatusHandler handler);     // Zone number, open
+    void onTrouble(dscStatusHandler handler);        // 0, trouble
+    void onPgmChange(dscStatusHandler handler);      // PGM output number, enabled
     byte panelVersion;
 
     /* panelData[] and moduleData[] store panel and keypad/module data in an array: command [0], stop bit by itself [1],
@@ -134,27 +531,71 @@ class dscKeybusInterface {
      */
     static byte panelData[dscReadSize];
     static volatile byte moduleData[dscReadSize];
+    static unsigned long panelTime;  // millis() at the end of the Keybus command in panelData[]
+
+    #if defined(DSC_LATENCY_STATS)
+    // Latency from the end of a Keybus command to processing in loop(), from the end of the Keybus command that set
+    // statusChanged to the sketch publishing it - the sketch records publishLatency using statusTime, or panelTime
+    // from a status handler - and from write() until the last key of the command is written to the Keybus
+    dscLatencyHistogram decodeLatency, publishLatency, writeLatency;
+
+    // Latency from passing an F/A/P alarm key to dscClockInterrupt() until the key is repeated for the 0x1C
+    // verification, the wait before writing the next key (previously a fixed 500ms)
+    dscLatencyHistogram alarmVerifyLatency;
+    unsigned long statusTime;        // panelTime of the command that set statusChanged
+    #endif
 
-    // status[] and lights[] store the current status message and LED state for each partition.  These can be accessed
-    // directly in the sketch to get data that is not already tracked in the library.  See printPanelMessages() and
-    // printPanelLights() in dscKeybusPrintData.cpp to see how this data translates to the status message and LED status.
-    byte status[dscPartitions];
-    byte lights[dscPartitions];
+    // Number of partitions skipped by status commands because their lights and status were unchanged
+    unsigned long partitionStatusSkipped;
 
-    // Process keypad and module data, returns true if data is available
+    // Process keypad and module data, returns true if data is available - each call processes the next keypad or
+    // module response from the module buffer
     bool handleModule();
 
+    // Number of keypad and module responses dropped with the module buffer full, saturates at 255
+    static volatile byte moduleBufferOverflows;
+
     // True if dscBufferSize needs to be increased
     static volatile bool bufferOverflow;
 
+    // Maximum number of bytes held in the panel data buffer since startup, used to size dscBufferSize
+    static volatile dscBufferIndex bufferHighWater;
+
     // Timer interrupt function to capture data - declared as public for use by AVR Timer1
     static void dscDataInterrupt();
 
+    #if defined(DSC_ISR_STATS)
+    // Copies the interrupt timing and capture statistics, without disabling interrupts
+    void readInterruptStats(dscInterruptStats &stats);
+    #endif
+
+    #if defined(DSC_CAPTURE)
+    // Records each panel command and keypad/module response read by loop() and handleModule() to the output in the
+    // binary capture format, before redundant data is skipped
+    void captureBegin(Print &output);
+    void captureEnd();
+
+    // Processes a recorded panel command or keypad/module response as loop() and handleModule() would, returns true if
+    // valid data is available in panelData[] or moduleData[]
+    bool replayPanel(const byte data[], byte byteCount, byte bitCount, unsigned long time);
+    bool replayModule(byte cmd, byte subCmd, const byte data[], byte byteCount, byte bitCount);
+    #endif
+
+    #if defined(__AVR__) && defined(DSC_TIMER1_CAPTURE)
+    // Timer1 overflow count to extend clock timestamps - declared as public for use by AVR Timer1
+    static volatile unsigned int timer1Overflows;
+
+    // Keybus clock period in microseconds measured between clock rising edges within a command
+    static volatile unsigned long clockPeriod;
+    #endif
+
     // Deprecated
     bool processRedundantData;  // Controls if repeated periodic commands are processed and displayed (default: false)
 
   private:
 
+    bool processPanelRecord();
+    bool processModuleRecord();
     void processPanelStatus();
     void processPanelStatus0(byte partition, byte panelByte);
     void processPanelStatus1(byte partition, byte panelByte);
@@ -175,6 +616,8 @@ class dscKeybusInterface {
     void processPanel_0xE6_0x0F();
     void processPanel_0xE6_0x1A();
     void processPanel_0xEB();
+    static byte nextChangedBit(byte changedFlags[], byte flagGroups, byte fromBit);
+    byte processStatusFlags(byte partitionIndex, byte flagMask, byte flagValues);
     void processReadyStatus(byte partitionIndex, bool status);
     void processAlarmStatus(byte partitionIndex, bool status);
     void processExitDelayStatus(byte partitionIndex, bool status);
@@ -183,9 +626,11 @@ class dscKeybusInterface {
     void processZoneStatus(byte zonesByte, byte panelByte);
     void processTime(byte panelByte);
     void processAlarmZones(byte panelByte, byte startByte, byte zoneCountOffset, byte writeValue);
-    void processAlarmZonesStatus(byte zonesByte, byte zoneCount, byte writeValue);
+    void processAlarmZonesStatus(byte zoneIndex, byte writeValue);
     void processArmed(byte partitionIndex, bool armedStatus);
     void processPanelAccessCode(byte partitionIndex, byte dscCode, bool accessCodeIncrease = true);
+    void pushStatusEvent(byte type, byte index, byte value);
+    void pushStatusEvents(byte type, byte firstNumber, byte changedBits, byte values);
 
     void printPanelPartitionStatus(byte startPartition, byte startByte, byte endByte);
     void printPanelStatus0(byte panelByte);
@@ -289,10 +734,16 @@ class dscKeybusInterface {
     void printModuleProgramming(byte panelByte2, byte panelByte3);
 
     bool validCRC();
-    void writeKeys(const char * writeKeysArray);
-    void setWriteKey(const char receivedKey);
+    void writeKeys();
+    bool setWriteKey(byte partition, const char receivedKey);
     static void dscClockInterrupt();
     static bool redundantPanelData(byte previousCmd[], volatile byte currentCmd[], byte checkedBytes = dscReadSize);
+    static dscBufferIndex panelBufferUsed();
+    #if defined(DSC_ISR_STATS)
+    static void recordInterruptTiming(volatile dscInterruptTiming &timing, unsigned long cycles);
+    static volatile dscInterruptStats isrStats;
+    static volatile byte isrStatsSequence;  // Incremented by the interrupts after each statistics update
+    #endif
 
     #if defined(ESP32)
     static hw_timer_t * timer1;
@@ -300,44 +751,102 @@ class dscKeybusInterface {
     #endif
 
     Stream* stream;
-    const char* writeKeysArray;
-    bool writeKeysPending;
-    bool writeAccessCode[dscPartitions];
+    #if defined(DSC_CAPTURE)
+    void writeCaptureRecord(byte recordType);
+    Print* captureOutput;
+    unsigned long captureTime;
+    #endif
+    bool queueWriteKey(const char receivedKey);
+    byte writeBuffer[dscWriteBufferSize];  // Ring buffer of keys written by write() and read by loop(), not by the interrupts
+    byte writeBufferHead, writeBufferCount;
+    byte writeBufferPartition;             // Partition of the keys at the end of the write buffer
+    bool writeSetPartition;                // Set by the '/' key to select the partition with the next key
+    byte writeHeadPartition;               // Partition of the keys at the start of the write buffer
+    byte writeSlotIndex[dscPartitions + 1];  // Write buffer index + 1 of the key in writeKey[] and writeAlarmKey, 0 if none
+    unsigned long writeAlarmTime;          // millis() when the last alarm key was passed to dscClockInterrupt()
+    void processMacro();
+    bool queueMacroKeys(const char *keys);
+    void endMacro(byte status);
+    const byte *macroInstruction;          // PROGMEM address of the next macro instruction, NULL if no macro is running
+    const char *macroAccessCode;
+    byte macroPartition;                   // Partition of the macro keys
+    bool macroWaiting;                     // True once the preceding keys are written and the instruction is waiting
+    bool macroPrompt;                      // Set when the panel requests an access code for the macro partition
+    uint16_t macroFirstKey, macroEndKey;   // Sequence of the first waiting macro key and the key following the last macro key
+    unsigned long macroTime;               // millis() of the last macro progress
+    #if defined(DSC_LATENCY_STATS)
+    bool writeAlarmVerifying;              // Set until the 0x1C verification of the last alarm key is recorded
+    static volatile unsigned long writeRepeatTime;  // millis() when dscClockInterrupt() repeated the last alarm key
+    #endif
+    byte trackWriteCommand(uint16_t firstKey);
+    void updateWriteCommands();
+    void dropWriteKeys(uint16_t firstKey, uint16_t endKey);
+    dscWriteCommand writeCommands[dscWriteCommandSize];  // Written and read by loop() and the sketch, not by the interrupts
+    byte writeCommandIndex;                // Slot of the newest command
+    byte writeHandle;                      // Handle of the newest command
+    byte writeBlockingHandle;              // Handle of the command still being buffered by a blocking write(), 0 if none
+    bool writeCommandsPending;             // True while a tracked command is queued or in progress
+    uint16_t writeKeysQueued;              // Number of keys written to the write buffer, including partition markers
+    union {
+      dscPartitionFlags<&dscPartitionState::other, dscWriteAccessCodeFlag> writeAccessCode;
+    };
     bool queryResponse;
     bool previousTrouble;
     bool previousKeybus;
     bool previousPower;
-    bool previousDisabled[dscPartitions];
-    byte previousAccessCode[dscPartitions];
-    byte previousLights[dscPartitions], previousStatus[dscPartitions];
-    bool previousReady[dscPartitions];
-    bool previousExitDelay[dscPartitions], previousEntryDelay[dscPartitions];
-    byte previousExitState[dscPartitions];
-    bool previousArmed[dscPartitions], previousArmedStay[dscPartitions], previousNoEntryDelay[dscPartitions];
-    bool previousAlarm[dscPartitions];
-    bool previousFire[dscPartitions];
+    byte statusCached;  // Partitions with lights[] and status[] set by a status command, 1 bit per partition
     byte previousOpenZones[dscZones], previousAlarmZones[dscZones];
     byte previousPgmOutputs[2];
     bool keybusVersion1;
+    dscStatusEvent statusEvents[dscStatusEventBufferSize];  // Ring buffer written and read by loop() and the sketch, not by the interrupts
+    byte statusEventHead, statusEventCount;
+    bool statusEventsDropped;  // Set with the buffer full or by resetStatus(), read as dscEventResync
+    static dscStatusHandler statusHandlers[dscEventTypes];
+    void logPanelEvent(byte partition, byte eventClass, byte argument);
+    dscPanelEvent panelEvents[dscPanelEventBufferSize];  // Ring buffer written and read by loop() and the sketch, not by the interrupts
+    byte panelEventHead, panelEventCount;
+    byte panelEventCmd;  // Panel command of the newest logged event
+
+    // Double buffered status snapshot, snapshots[snapshotIndex] is read by statusSnapshot()
+    void updateStatusSnapshot();
+    dscStatusSnapshot snapshots[2];
+    byte snapshotIndex;
 
     static byte dscClockPin;
     static byte dscReadPin;
     static byte dscWritePin;
-    static byte writeByte, writeBit;
+    #if defined(__AVR__)
+    static volatile uint8_t *dscClockPort, *dscReadPort, *dscWritePort;  // Port registers resolved in begin() for the interrupts
+    static uint8_t dscClockMask, dscReadMask, dscWriteMask;
+    #endif
     static bool virtualKeypad;
-    static char writeKey;
+    static char writeKey[dscPartitions];  // Key written for each partition while writeKeyPending[] is set
+    static char writeAlarmKey;            // F/A/P alarm key written while writeAlarm is set
     static byte panelBitCount, panelByteCount;
-    static volatile bool writeKeyPending;
-    static volatile bool writeAlarm, starKeyCheck, starKeyWait[dscPartitions];
-    static volatile bool moduleDataDetected, moduleDataCaptured;
+    static volatile bool writeKeyPending[dscPartitions];
+    static volatile bool writeAlarm, writeRepeat, starKeyCheck[dscPartitions], starKeyWait[dscPartitions];
+    static volatile bool writeStart;  // Set by dscClockInterrupt() while a key is being written
+    static volatile bool moduleDataDetected;
     static volatile unsigned long clockHighTime, keybusTime;
-    static volatile byte panelBufferLength;
-    static volatile byte panelBuffer[dscBufferSize][dscReadSize];
-    static volatile byte panelBufferBitCount[dscBufferSize], panelBufferByteCount[dscBufferSize];
+    static volatile dscBufferIndex panelBufferHead, panelBufferTail;  // Ring buffer indices: head is only written by dscClockInterrupt(), tail is only written by loop()
+    static volatile byte panelBuffer[dscBufferBytes];
     static volatile byte moduleBitCount, moduleByteCount;
     static volatile byte currentCmd, statusCmd, moduleCmd, moduleSubCmd;
     static volatile byte isrPanelData[dscReadSize], isrPanelBitTotal, isrPanelBitCount, isrPanelByteCount;
     static volatile byte isrModuleData[dscReadSize];
+    static volatile dscBufferIndex moduleBufferHead, moduleBufferTail;  // Ring buffer indices: head is only written by dscClockInterrupt(), tail is only written by handleModule()
+    static volatile byte moduleBuffer[dscModuleBufferBytes];
 };
 
+
+template <byte dscPartitionState::*field, byte mask>
+inline dscPartitionFlag dscPartitionFlags<field, mask>::operator[](byte partitionIndex) const {
+  return dscPartitionFlag(dscKeybusInterface::partitionState[partitionIndex].*field, mask);
+}
+
+template <byte dscPartitionState::*field>
+inline byte &dscPartitionBytes<field>::operator[](byte partitionIndex) const {
+  return dscKeybusInterface::partitionState[partitionIndex].*field;
+}
+
 #endif // dscKeybus_h
@@ -20,6 +20,77 @@
 #include "dscKeybus.h"
 
 
+/*
+ *  Keybus pin access for the interrupts
+ *
+ *  digitalRead() and digitalWrite() look up the pin port and bit mask on each call, which adds tens of cycles per
+ *  access on AVR.  The port registers and masks are instead resolved once in begin(), and pins fixed at build time
+ *  with DSC_CLOCK_PIN, DSC_READ_PIN, and DSC_WRITE_PIN on ATmega328P/168 compile to single instruction port access.
+ */
+#if defined(__AVR__)
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+#define dscPinInput(pin) ((pin) < 8 ? PIND : ((pin) < 14 ? PINB : PINC))
+#define dscPinOutput(pin) ((pin) < 8 ? PORTD : ((pin) < 14 ? PORTB : PORTC))
+#define dscPinMask(pin) (1 << ((pin) < 8 ? (pin) : ((pin) < 14 ? (pin) - 8 : (pin) - 14)))
+#endif
+
+#if defined(DSC_CLOCK_PIN) && defined(dscPinInput)
+#define dscClockHigh() (dscPinInput(DSC_CLOCK_PIN) & dscPinMask(DSC_CLOCK_PIN))
+#else
+#define dscClockHigh() (*dscClockPort & dscClockMask)
+#endif
+
+#if defined(DSC_READ_PIN) && defined(dscPinInput)
+#define dscReadHigh() (dscPinInput(DSC_READ_PIN) & dscPinMask(DSC_READ_PIN))
+#else
+#define dscReadHigh() (*dscReadPort & dscReadMask)
+#endif
+
+#if defined(DSC_WRITE_PIN) && defined(dscPinOutput)
+#define dscWriteHigh() (dscPinOutput(DSC_WRITE_PIN) |= dscPinMask(DSC_WRITE_PIN))
+#define dscWriteLow() (dscPinOutput(DSC_WRITE_PIN) &= ~dscPinMask(DSC_WRITE_PIN))
+#else
+#define dscWriteHigh() (*dscWritePort |= dscWriteMask)
+#define dscWriteLow() (*dscWritePort &= ~dscWriteMask)
+#endif
+
+#else
+#define dscClockHigh() (digitalRead(dscClockPin) == HIGH)
+#define dscReadHigh() (digitalRead(dscReadPin) == HIGH)
+#define dscWriteHigh() digitalWrite(dscWritePin, HIGH)
+#define dscWriteLow() digitalWrite(dscWritePin, LOW)
+#endif  // __AVR__
+
+
+/*
+ *  Interrupt timing for DSC_ISR_STATS
+ *
+ *  Arduino/AVR has no cycle counter, so Timer1 is read instead: it runs at the CPU clock from the reload in
+ *  dscClockInterrupt() and from the overflow that calls dscDataInterrupt(), or at 1/8 of the CPU clock with
+ *  DSC_TIMER1_CAPTURE.  esp8266 and esp32 read the CPU cycle counter.
+ */
+#if defined(DSC_ISR_STATS)
+#if defined(__AVR__)
+#define dscCycleCount() ((uint16_t)TCNT1)
+#define dscCycleElapsed(start) ((unsigned long)(uint16_t)(TCNT1 - (start)) * dscCycleScale)
+#if defined(DSC_TIMER1_CAPTURE)
+#define dscCycleScale 8
+#else
+#define dscCycleScale 1
+#endif
+#elif defined(ESP8266)
+#define dscCycleCount() ESP.getCycleCount()
+#define dscCycleElapsed(start) (ESP.getCycleCount() - (start))
+#elif defined(ESP32)
+#define dscCycleCount() xthal_get_ccount()
+#define dscCycleElapsed(start) (xthal_get_ccount() - (start))
+#elif defined(DSC_NATIVE)
+#define dscCycleCount() nativeCycleCount()
+#define dscCycleElapsed(start) (nativeCycleCount() - (start))
+#endif
+#endif  // DSC_ISR_STATS
+
+
 #if defined(ESP32)
 portMUX_TYPE dscKeybusInterface::timer1Mux = portMUX_INITIALIZER_UNLOCKED;
 hw_timer_t * dscKeybusInterface::timer1 = NULL;
@@ -36,20 +107,65 @@ dscKeybusInterface::dscKeybusInterface(byte setClockPin, byte setReadPin, byte s
   displayTrailingBits = false;
   processModuleData = false;
   writePartition = 1;
+  writeHeadPartition = 1;
   pauseStatus = false;
+  #if defined(DSC_CAPTURE)
+  captureOutput = NULL;
+  #endif
 }
 
 
 void dscKeybusInterface::begin(Stream &_stream) {
+  stream = &_stream;
+
+  // The interrupts access pins fixed at build time directly, so the interface is not started if the pins set in the
+  // constructor are different - capture would otherwise silently fail
+  #if defined(dscPinInput)
+  bool pinMismatch = false;
+  #if defined(DSC_CLOCK_PIN)
+  if (dscClockPin != DSC_CLOCK_PIN) pinMismatch = true;
+  #endif
+  #if defined(DSC_READ_PIN)
+  if (dscReadPin != DSC_READ_PIN) pinMismatch = true;
+  #endif
+  #if defined(DSC_WRITE_PIN)
+  if (virtualKeypad && dscWritePin != DSC_WRITE_PIN) pinMismatch = true;
+  #endif
+  if (pinMismatch) {
+    stream->println(F("Keybus pins do not match DSC_CLOCK_PIN, DSC_READ_PIN, or DSC_WRITE_PIN"));
+    return;
+  }
+  #endif
+
   pinMode(dscClockPin, INPUT);
   pinMode(dscReadPin, INPUT);
   if (virtualKeypad) pinMode(dscWritePin, OUTPUT);
-  stream = &_stream;
+
+  // Resolves the pin port registers and bit masks used by the interrupts
+  #if defined(__AVR__)
+  dscClockPort = portInputRegister(digitalPinToPort(dscClockPin));
+  dscClockMask = digitalPinToBitMask(dscClockPin);
+  dscReadPort = portInputRegister(digitalPinToPort(dscReadPin));
+  dscReadMask = digitalPinToBitMask(dscReadPin);
+  if (virtualKeypad) {
+    dscWritePort = portOutputRegister(digitalPinToPort(dscWritePin));
+    dscWriteMask = digitalPinToBitMask(dscWritePin);
+  }
+  #endif
 
   // Platform-specific timers trigger a read of the data line 250us after the Keybus clock changes
 
+  // Arduino/AVR Timer1 runs freely with a 0.5us tick to timestamp clock changes, and dscClockInterrupt() schedules
+  // ISR(TIMER1_COMPA_vect) with an output compare 250us after each clock change.  The overflow interrupt extends
+  // the timestamps beyond 32ms.
+  #if defined(__AVR__) && defined(DSC_TIMER1_CAPTURE)
+  TCCR1A = 0;
+  TCCR1B = (1 << CS11);  // Sets the prescaler to 8
+  TIFR1 = (1 << OCF1A) | (1 << TOV1);
+  TIMSK1 = (1 << TOIE1);
+
   // Arduino/AVR Timer1 calls ISR(TIMER1_OVF_vect) from dscClockInterrupt() and is disabled in the ISR for a one-shot timer
-  #if defined(__AVR__)
+  #elif defined(__AVR__)
   TCCR1A = 0;
   TCCR1B = 0;
   TIMSK1 |= (1 << TOIE1);
@@ -67,6 +183,10 @@ void dscKeybusInterface::begin(Stream &_stream) {
   timerAttachInterrupt(timer1, &dscDataInterrupt, true);
   timerAlarmWrite(timer1, 250, true);
   timerAlarmEnable(timer1);
+
+  // Native builds call dscDataInterrupt() from the virtual timer of the Arduino shim in extras/native
+  #elif defined(DSC_NATIVE)
+  nativeTimerAttach(dscDataInterrupt);
   #endif
 
   // Generates an interrupt when the Keybus clock rises or falls - requires a hardware interrupt pin on Arduino/AVR
@@ -79,6 +199,9 @@ void dscKeybusInterface::stop() {
   // Disables Arduino/AVR Timer1 interrupts
   #if defined(__AVR__)
   TIMSK1 = 0;
+  #if defined(DSC_TIMER1_CAPTURE)
+  TCCR1B = 0;
+  #endif
 
   // Disables esp8266 timer1
   #elif defined(ESP8266)
@@ -89,13 +212,18 @@ void dscKeybusInterface::stop() {
   #elif defined(ESP32)
   timerAlarmDisable(timer1);
   timerEnd(timer1);
+
+  // Disables the native virtual timer
+  #elif defined(DSC_NATIVE)
+  nativeTimerAttach(NULL);
   #endif
 
   // Disables the Keybus clock pin interrupt
   detachInterrupt(digitalPinToInterrupt(dscClockPin));
 
   // Resets the panel capture data and counters
-  panelBufferLength = 0;
+  panelBufferHead = 0;
+  panelBufferTail = 0;
   for (byte i = 0; i < dscReadSize; i++) isrPanelData[i] = 0;
   isrPanelBitTotal = 0;
   isrPanelBitCount = 0;
@@ -103,6 +231,8 @@ void dscKeybusInterface::stop() {
 
   // Resets the keypad and module capture data
   for (byte i = 0; i < dscReadSize; i++) isrModuleData[i] = 0;
+  moduleBufferHead = 0;
+  moduleBufferTail = 0;
 }
 
 
@@ -131,42 +261,68 @@ bool dscKeybusInterface::loop() {
   if (previousKeybus != keybusConnected) {
     previousKeybus = keybusConnected;
     keybusChanged = true;
+    pushStatusEvent(dscEventKeybus, 0, keybusConnected);
+    updateStatusSnapshot();
     if (!pauseStatus) statusChanged = true;
     if (!keybusConnected) return true;
   }
 
-  // Writes keys when multiple keys are sent as a char array
-  if (writeKeysPending) writeKeys(writeKeysArray);
-
-  // Skips processing if the panel data buffer is empty
-  if (panelBufferLength == 0) return false;
+  // Runs the keypad macro started by runMacro()
+  if (macroInstruction != NULL) processMacro();
 
-  // Copies data from the buffer to panelData[]
-  static byte panelBufferIndex = 1;
-  byte dataIndex = panelBufferIndex - 1;
-  for (byte i = 0; i < dscReadSize; i++) panelData[i] = panelBuffer[dataIndex][i];
-  panelBitCount = panelBufferBitCount[dataIndex];
-  panelByteCount = panelBufferByteCount[dataIndex];
-  panelBufferIndex++;
+  // Writes keys from the write buffer and updates the status of tracked write commands
+  if (writeBufferCount > 0 || writeCommandsPending) writeKeys();
 
-  // Resets counters when the buffer is cleared
-  #if defined(ESP32)
-  portENTER_CRITICAL(&timer1Mux);
-  #else
-  noInterrupts();
+  #if defined(DSC_LATENCY_STATS)
+  if (writeAlarmVerifying && !writeAlarm && !writeRepeat) {
+    writeAlarmVerifying = false;
+    alarmVerifyLatency.record(writeRepeatTime - writeAlarmTime);
+  }
   #endif
 
-  if (panelBufferIndex > panelBufferLength) {
-    panelBufferIndex = 1;
-    panelBufferLength = 0;
+  // Skips processing if the panel data buffer is empty
+  dscBufferIndex bufferIndex = panelBufferTail;
+  if (bufferIndex == panelBufferHead) return false;
+
+  // Copies the next record from the buffer to panelData[]: byte count, bit count, capture time, followed by the
+  // captured bytes
+  panelByteCount = panelBuffer[bufferIndex];
+  if (++bufferIndex == dscBufferBytes) bufferIndex = 0;
+  panelBitCount = panelBuffer[bufferIndex];
+  if (++bufferIndex == dscBufferBytes) bufferIndex = 0;
+  uint16_t captureTime = panelBuffer[bufferIndex];
+  if (++bufferIndex == dscBufferBytes) bufferIndex = 0;
+  captureTime |= panelBuffer[bufferIndex] << 8;
+  if (++bufferIndex == dscBufferBytes) bufferIndex = 0;
+
+  // The capture time is stored as the lower 16 bits of millis() and is extended relative to the current time
+  unsigned long currentTime = millis();
+  panelTime = currentTime - (uint16_t)((uint16_t)currentTime - captureTime);
+
+  byte recordBytes = panelByteCount < dscReadSize ? panelByteCount + 1 : dscReadSize;  // Includes trailing bits
+  for (byte i = 0; i < dscReadSize; i++) {
+    if (i < recordBytes) {
+      panelData[i] = panelBuffer[bufferIndex];
+      if (++bufferIndex == dscBufferBytes) bufferIndex = 0;
+    }
+    else panelData[i] = 0;
   }
 
-  #if defined(ESP32)
-  portEXIT_CRITICAL(&timer1Mux);
-  #else
-  interrupts();
+  // Releases the record to dscClockInterrupt() - the tail index is only written here and the head index is only
+  // written by the interrupt, so the buffer does not need to be locked
+  panelBufferTail = bufferIndex;
+
+  #if defined(DSC_CAPTURE)
+  if (captureOutput != NULL) writeCaptureRecord(dscCapturePanel);
   #endif
 
+  return processPanelRecord();
+}
+
+
+// Processes the panel command in panelData[], returns true if valid panel data is available
+bool dscKeybusInterface::processPanelRecord() {
+
   // Waits at startup for the 0x05 status command or a command with valid CRC data to eliminate spurious data.
   static bool startupCycle = true;
   if (startupCycle) {
@@ -180,7 +336,7 @@ bool dscKeybusInterface::loop() {
   }
 
   // Sets writeReady status
-  if (!writeKeyPending && !writeKeysPending) writeReady = true;
+  if (writeBufferCount == 0) writeReady = true;
   else writeReady = false;
 
   // Skips redundant data sent constantly while in installer programming
@@ -207,29 +363,94 @@ bool dscKeybusInterface::loop() {
     if (panelData[0] == 0xE6 && panelData[2] == 0x03 && redundantPanelData(previousCmdE6_03, panelData, 8)) return false;  // Status in alarm/programming, partitions 5-8
   }
 
-  // Processes valid panel data
+  #if defined(DSC_LATENCY_STATS)
+  decodeLatency.record(millis() - panelTime);
+  bool previousStatusChanged = statusChanged;
+  #endif
+
+  // Processes valid panel data - commands for partitions and zones above the configured capacity are compiled out
   switch (panelData[0]) {
-    case 0x05:                                                     // Panel status: partitions 1-4
-    case 0x1B: processPanelStatus(); break;                        // Panel status: partitions 5-8
-    case 0x16: processPanel_0x16(); break;                         // Panel configuration
-    case 0x27: processPanel_0x27(); break;                         // Panel status and zones 1-8 status
-    case 0x2D: processPanel_0x2D(); break;                         // Panel status and zones 9-16 status
-    case 0x34: processPanel_0x34(); break;                         // Panel status and zones 17-24 status
-    case 0x3E: processPanel_0x3E(); break;                         // Panel status and zones 25-32 status
-    case 0x87: processPanel_0x87(); break;                         // PGM outputs
-    case 0xA5: processPanel_0xA5(); break;                         // Date, time, system status messages - partitions 1-2
-    case 0xE6: if (dscPartitions > 2) processPanel_0xE6(); break;  // Extended status command split into multiple subcommands to handle up to 8 partitions/64 zones
-    case 0xEB: if (dscPartitions > 2) processPanel_0xEB(); break;  // Date, time, system status messages - partitions 1-8
+    case 0x05: processPanelStatus(); break;                            // Panel status: partitions 1-4
+    case 0x1B: if (dscPartitions > 4) processPanelStatus(); break;     // Panel status: partitions 5-8
+    case 0x16: processPanel_0x16(); break;                             // Panel configuration
+    case 0x27: processPanel_0x27(); break;                             // Panel status and zones 1-8 status
+    case 0x2D: if (dscZones > 1) processPanel_0x2D(); break;           // Panel status and zones 9-16 status
+    case 0x34: if (dscZones > 2) processPanel_0x34(); break;           // Panel status and zones 17-24 status
+    case 0x3E: if (dscZones > 3) processPanel_0x3E(); break;           // Panel status and zones 25-32 status
+    case 0x87: processPanel_0x87(); break;                             // PGM outputs
+    case 0xA5: processPanel_0xA5(); break;                             // Date, time, system status messages - partitions 1-2
+    case 0xE6: if (dscExtendedStatus) processPanel_0xE6(); break;      // Extended status command split into multiple subcommands to handle up to 8 partitions/64 zones
+    case 0xEB: if (dscExtendedStatus) processPanel_0xEB(); break;      // Date, time, system status messages - partitions 1-8
   }
 
+  #if defined(DSC_LATENCY_STATS)
+  if (statusChanged && !previousStatusChanged) statusTime = panelTime;
+  #endif
+
+  updateStatusSnapshot();
   return true;
 }
 
 
+#if defined(DSC_LATENCY_STATS)
+void dscLatencyHistogram::record(unsigned long latency) {
+  if (latency > maxLatency) maxLatency = latency;
+
+  byte bucket = 0;
+  while (latency > 0 && bucket < dscLatencyBuckets - 1) {
+    latency >>= 1;
+    bucket++;
+  }
+  if (buckets[bucket] < 0xFFFF) buckets[bucket]++;
+}
+
+
+void dscLatencyHistogram::reset() {
+  for (byte bucket = 0; bucket < dscLatencyBuckets; bucket++) buckets[bucket] = 0;
+  maxLatency = 0;
+}
+#endif
+
+
 bool dscKeybusInterface::handleModule() {
-  if (!moduleDataCaptured) return false;
-  moduleDataCaptured = false;
 
+  // Skips processing if the module data buffer is empty
+  dscBufferIndex bufferIndex = moduleBufferTail;
+  if (bufferIndex == moduleBufferHead) return false;
+
+  // Copies the next record from the buffer to moduleData[]: panel command, panel subcommand, byte count, bit count,
+  // followed by the captured bytes
+  moduleCmd = moduleBuffer[bufferIndex];
+  if (++bufferIndex == dscModuleBufferBytes) bufferIndex = 0;
+  moduleSubCmd = moduleBuffer[bufferIndex];
+  if (++bufferIndex == dscModuleBufferBytes) bufferIndex = 0;
+  moduleByteCount = moduleBuffer[bufferIndex];
+  if (++bufferIndex == dscModuleBufferBytes) bufferIndex = 0;
+  moduleBitCount = moduleBuffer[bufferIndex];
+  if (++bufferIndex == dscModuleBufferBytes) bufferIndex = 0;
+
+  byte recordBytes = moduleByteCount < dscReadSize ? moduleByteCount + 1 : dscReadSize;  // Includes trailing bits
+  for (byte i = 0; i < dscReadSize; i++) {
+    if (i < recordBytes) {
+      moduleData[i] = moduleBuffer[bufferIndex];
+      if (++bufferIndex == dscModuleBufferBytes) bufferIndex = 0;
+    }
+    else moduleData[i] = 0;
+  }
+
+  // Releases the record to dscClockInterrupt()
+  moduleBufferTail = bufferIndex;
+
+  #if defined(DSC_CAPTURE)
+  if (captureOutput != NULL) writeCaptureRecord(dscCaptureModule);
+  #endif
+
+  return processModuleRecord();
+}
+
+
+// Processes the keypad or module response in moduleData[], returns true if valid module data is available
+bool dscKeybusInterface::processModuleRecord() {
   if (moduleBitCount < 8) return false;
 
   // Determines if a keybus message is a response to a panel command
@@ -243,179 +464,475 @@ bool dscKeybusInterface::handleModule() {
   return true;
 }
 
-// Sets up writes for a single key
-void dscKeybusInterface::write(const char receivedKey) {
 
-  // Blocks if a previous write is in progress
-  while(writeKeyPending || writeKeysPending) {
-    loop();
-    #if defined(ESP8266)
-    yield();
-    #endif
+#if defined(DSC_CAPTURE)
+void dscKeybusInterface::captureBegin(Print &output) {
+  captureOutput = &output;
+  captureTime = 0;
+  output.write((const uint8_t *)"DSCK", 4);
+  output.write(dscCaptureVersion);
+  output.write(dscReadSize);
+}
+
+
+void dscKeybusInterface::captureEnd() {
+  captureOutput = NULL;
+}
+
+
+// Writes the record in panelData[] or moduleData[] to the capture output
+void dscKeybusInterface::writeCaptureRecord(byte recordType) {
+  byte record[dscReadSize + 9];
+  byte recordIndex = 0;
+  byte byteCount, bitCount;
+  const volatile byte *data;
+
+  record[recordIndex++] = recordType;
+  if (recordType == dscCapturePanel) {
+    unsigned long timeDelta = panelTime - captureTime;
+    captureTime = panelTime;
+    if (timeDelta < 0xFFFF) {
+      record[recordIndex++] = timeDelta;
+      record[recordIndex++] = timeDelta >> 8;
+    }
+    else {
+      record[recordIndex++] = 0xFF;
+      record[recordIndex++] = 0xFF;
+      for (byte i = 0; i < 4; i++) record[recordIndex++] = panelTime >> (i * 8);
+    }
+    byteCount = panelByteCount;
+    bitCount = panelBitCount;
+    data = panelData;
+  }
+  else {
+    record[recordIndex++] = moduleCmd;
+    record[recordIndex++] = moduleSubCmd;
+    byteCount = moduleByteCount;
+    bitCount = moduleBitCount;
+    data = moduleData;
   }
 
-  setWriteKey(receivedKey);
+  record[recordIndex++] = byteCount;
+  record[recordIndex++] = bitCount;
+  byte recordBytes = byteCount < dscReadSize ? byteCount + 1 : dscReadSize;  // Includes trailing bits
+  for (byte i = 0; i < recordBytes; i++) record[recordIndex++] = data[i];
+
+  captureOutput->write(record, recordIndex);
 }
 
 
-// Sets up writes for multiple keys sent as a char array
-void dscKeybusInterface::write(const char *receivedKeys, bool blockingWrite) {
+bool dscKeybusInterface::replayPanel(const byte data[], byte byteCount, byte bitCount, unsigned long time) {
+  panelByteCount = byteCount;
+  panelBitCount = bitCount;
+  panelTime = time;
 
-  // Blocks if a previous write is in progress
-  while(writeKeyPending || writeKeysPending) {
-    loop();
-    #if defined(ESP8266)
-    yield();
-    #endif
+  byte recordBytes = byteCount < dscReadSize ? byteCount + 1 : dscReadSize;
+  for (byte i = 0; i < dscReadSize; i++) {
+    if (i < recordBytes) panelData[i] = data[i];
+    else panelData[i] = 0;
   }
 
-  writeKeysArray = receivedKeys;
+  return processPanelRecord();
+}
 
-  if (writeKeysArray[0] != '\0') {
-    writeKeysPending = true;
-    writeReady = false;
+
+bool dscKeybusInterface::replayModule(byte cmd, byte subCmd, const byte data[], byte byteCount, byte bitCount) {
+  moduleCmd = cmd;
+  moduleSubCmd = subCmd;
+  moduleByteCount = byteCount;
+  moduleBitCount = bitCount;
+
+  byte recordBytes = byteCount < dscReadSize ? byteCount + 1 : dscReadSize;
+  for (byte i = 0; i < dscReadSize; i++) {
+    if (i < recordBytes) moduleData[i] = data[i];
+    else moduleData[i] = 0;
   }
 
-  // Optionally blocks until the write is complete, necessary if the received keys char array is ephemeral
+  return processModuleRecord();
+}
+#endif
+
+// Sets up writes for a single key
+byte dscKeybusInterface::write(const char receivedKey) {
+  if (writeBufferCount + 2 > dscWriteBufferSize) return 0;  // Leaves room for a partition selection
+  uint16_t firstKey = writeKeysQueued;
+  queueWriteKey(receivedKey);
+  return trackWriteCommand(firstKey);
+}
+
+
+// Copies multiple keys sent as a char array to the write buffer
+byte dscKeybusInterface::write(const char *receivedKeys, bool blockingWrite) {
+  uint16_t firstKey = writeKeysQueued;
+
+  // Optionally blocks until all keys are written, waiting for room in the write buffer for each key
   if (blockingWrite) {
-    while (writeKeysPending) {
-      writeKeys(writeKeysArray);
+    byte handle = 0;
+    byte commandIndex = 0;
+    for (byte keyIndex = 0; receivedKeys[keyIndex] != '\0'; keyIndex++) {
+      while (writeBufferCount + 2 > dscWriteBufferSize) {
+        loop();
+        #if defined(ESP8266)
+        yield();
+        #endif
+      }
+      queueWriteKey(receivedKeys[keyIndex]);
+      if (writeKeysQueued == firstKey) continue;  // Partition selections before the first key do not add keys
+
+      // Tracks the keys as a single command from the first key, extended as each key is buffered.  The command is
+      // not completed until all keys are buffered, and stops buffering keys if it times out.
+      if (handle == 0) {
+        handle = trackWriteCommand(firstKey);
+        commandIndex = writeCommandIndex;
+        writeBlockingHandle = handle;
+      }
+      else if (writeCommands[commandIndex].handle == handle) {
+        writeCommands[commandIndex].endKey = writeKeysQueued;
+        updateWriteCommands();
+      }
+      if (writeStatus(handle) == dscWriteTimedOut) break;
+    }
+    writeBlockingHandle = 0;
+
+    if (handle == 0) handle = trackWriteCommand(firstKey);  // Commands with only partition selections are written immediately
+    else updateWriteCommands();
+
+    while (writeStatus(handle) == dscWriteQueued || writeStatus(handle) == dscWriteInProgress) {
       loop();
       #if defined(ESP8266)
       yield();
       #endif
     }
+    writeKeys();
+    return handle;
   }
-  else writeKeys(writeKeysArray);
+
+  // Each partition selection in the keys uses 2 keys ('/' and the partition) and adds 1 partition marker to the
+  // buffer, so the keys use at most the number of keys plus 1 for a partition marker before the first key
+  if (writeBufferCount + strlen(receivedKeys) + 1 > dscWriteBufferSize) return 0;
+  for (byte keyIndex = 0; receivedKeys[keyIndex] != '\0'; keyIndex++) queueWriteKey(receivedKeys[keyIndex]);
+  return trackWriteCommand(firstKey);
 }
 
 
-// Writes multiple keys from a char array
-void dscKeybusInterface::writeKeys(const char *writeKeysArray) {
-  static byte writeCounter = 0;
-  if (!writeKeyPending && writeKeysPending && writeCounter < strlen(writeKeysArray)) {
-    if (writeKeysArray[writeCounter] != '\0') {
-      setWriteKey(writeKeysArray[writeCounter]);
-      writeCounter++;
-      if (writeKeysArray[writeCounter] == '\0') {
-        writeKeysPending = false;
-        writeCounter = 0;
+// Adds a key to the write buffer, preceded by a partition marker (0x80 | partition) if the key is for a different
+// partition than the previous key in the buffer.  Partition selections with the '/' key set writePartition here, so
+// the keys in the buffer keep the partition set when they were written.
+bool dscKeybusInterface::queueWriteKey(const char receivedKey) {
+  if (writeSetPartition) {
+    writeSetPartition = false;
+    if (receivedKey >= '1' && receivedKey <= '8') writePartition = receivedKey - 48;
+    return true;
+  }
+  if (receivedKey == '/') {
+    writeSetPartition = true;
+    return true;
+  }
+
+  byte keyCount = writeBufferPartition != writePartition ? 2 : 1;
+  if (writeBufferCount + keyCount > dscWriteBufferSize) return false;
+
+  byte bufferIndex = writeBufferHead + writeBufferCount;
+  if (bufferIndex >= dscWriteBufferSize) bufferIndex -= dscWriteBufferSize;
+  if (keyCount == 2) {
+    writeBufferPartition = writePartition;
+    writeBuffer[bufferIndex] = 0x80 | writePartition;
+    if (++bufferIndex == dscWriteBufferSize) bufferIndex = 0;
+  }
+  writeBuffer[bufferIndex] = receivedKey;
+  writeBufferCount += keyCount;
+  writeKeysQueued += keyCount;
+  writeReady = false;
+  return true;
+}
+
+
+// Tracks the keys written to the write buffer since firstKey as a new command, replacing the oldest tracked command.
+// Returns the handle of the command, skipping 0 as handles wrap.
+byte dscKeybusInterface::trackWriteCommand(uint16_t firstKey) {
+  if (++writeHandle == 0) writeHandle = 1;
+  if (++writeCommandIndex >= dscWriteCommandSize) writeCommandIndex = 0;
+
+  dscWriteCommand &command = writeCommands[writeCommandIndex];
+  command.handle = writeHandle;
+  command.status = dscWriteQueued;
+  command.firstKey = firstKey;
+  command.endKey = writeKeysQueued;
+  command.queuedTime = millis();
+  command.startTime = 0;
+  command.endTime = 0;
+  command.keysSkipped = false;
+  writeCommandsPending = true;
+
+  updateWriteCommands();  // Commands with only partition selections are written immediately
+  return writeHandle;
+}
+
+
+// Updates the status of tracked commands as keys are passed to dscClockInterrupt() and written.  Keys before the head of
+// the write buffer have been written, and the remaining keys of a command are checked in the buffer as keys for
+// different partitions can be written out of order.
+void dscKeybusInterface::updateWriteCommands() {
+  uint16_t headKey = writeKeysQueued - writeBufferCount;  // Sequence of the key at the head of the write buffer
+  unsigned long currentTime = millis();
+  writeCommandsPending = false;
+
+  for (byte commandIndex = 0; commandIndex < dscWriteCommandSize; commandIndex++) {
+    dscWriteCommand &command = writeCommands[commandIndex];
+    if (command.status != dscWriteQueued && command.status != dscWriteInProgress) continue;
+
+    // Compares key sequences as signed differences to handle the sequence wrapping
+    bool keysStarted = false;
+    bool keysWritten = true;
+    uint16_t key = command.firstKey;
+    if ((int16_t)(headKey - key) > 0) {
+      key = headKey;
+      keysStarted = true;
+    }
+    for (; (int16_t)(command.endKey - key) > 0; key++) {
+      byte bufferIndex = writeBufferHead + (byte)(key - headKey);
+      if (bufferIndex >= dscWriteBufferSize) bufferIndex -= dscWriteBufferSize;
+      byte bufferKey = writeBuffer[bufferIndex];
+
+      if (bufferKey == dscWriteKeyWritten) keysStarted = true;
+      else if (bufferKey == dscWriteKeySkipped) {
+        keysStarted = true;
+        command.keysSkipped = true;
+      }
+      else if (bufferKey == dscWriteKeyStarted) {
+        keysStarted = true;
+        keysWritten = false;
+      }
+      else if (bufferKey < 0x80) keysWritten = false;
+    }
+
+    if (keysStarted && command.status == dscWriteQueued) {
+      command.status = dscWriteInProgress;
+      command.startTime = currentTime;
+    }
+    if (keysWritten && command.handle != writeBlockingHandle) {
+      if (command.status == dscWriteQueued) command.startTime = currentTime;
+      command.endTime = currentTime;
+      if (command.keysSkipped) command.status = dscWriteSkipped;
+      else {
+        command.status = dscWriteWritten;
+        #if defined(DSC_LATENCY_STATS)
+        writeLatency.record(currentTime - command.queuedTime);
+        #endif
       }
     }
+
+    // Drops the remaining keys of a timed out command so that they are not written if the panel responds later
+    else if (currentTime - command.queuedTime > dscWriteTimeout) {
+      command.status = dscWriteTimedOut;
+      command.endTime = currentTime;
+      dropWriteKeys(command.firstKey, command.endKey);
+    }
+    else writeCommandsPending = true;
   }
 }
 
 
-// Specifies the key value to be written by dscClockInterrupt() and selects the write partition.  This includes a 500ms
-// delay after alarm keys to resolve errors when additional keys are sent immediately after alarm keys.
-void dscKeybusInterface::setWriteKey(const char receivedKey) {
-  static unsigned long previousTime;
-  static bool setPartition;
+// Drops the keys from firstKey until endKey that have not been written by marking them as written in the write
+// buffer.  Keys passed to dscClockInterrupt() are cancelled unless the interrupt is writing a key at that moment, in
+// which case the key is completed.
+void dscKeybusInterface::dropWriteKeys(uint16_t firstKey, uint16_t endKey) {
+  uint16_t headKey = writeKeysQueued - writeBufferCount;
+  if ((int16_t)(headKey - firstKey) > 0) firstKey = headKey;
+
+  for (uint16_t key = firstKey; (int16_t)(endKey - key) > 0; key++) {
+    byte bufferIndex = writeBufferHead + (byte)(key - headKey);
+    if (bufferIndex >= dscWriteBufferSize) bufferIndex -= dscWriteBufferSize;
+    if (writeBuffer[bufferIndex] < 0x80) writeBuffer[bufferIndex] = dscWriteKeyWritten;
+  }
+
+  // Cancels the keys in the dscClockInterrupt() slots, marked as written by writeKeys() once the slot is free.  A '*'
+  // key waiting for the panel response has already been written.
+  for (byte slot = 0; slot <= dscPartitions; slot++) {
+    if (writeSlotIndex[slot] == 0) continue;
+    byte keyOffset = writeSlotIndex[slot] - 1 + dscWriteBufferSize - writeBufferHead;
+    if (keyOffset >= dscWriteBufferSize) keyOffset -= dscWriteBufferSize;
+    uint16_t slotKey = headKey + keyOffset;
+    if ((int16_t)(slotKey - firstKey) < 0 || (int16_t)(endKey - slotKey) <= 0) continue;
+
+    #if defined(ESP32)
+    portENTER_CRITICAL(&timer1Mux);
+    #else
+    noInterrupts();
+    #endif
 
-  // Sets the write partition if set by virtual keypad key '/'
-  if (setPartition) {
-    setPartition = false;
-    if (receivedKey >= '1' && receivedKey <= '8') {
-      writePartition = receivedKey - 48;
+    if (slot == dscPartitions) {
+      if (!writeStart) writeAlarm = false;
     }
-    return;
+    else if (starKeyWait[slot] || !writeStart) {
+      writeKeyPending[slot] = false;
+      starKeyWait[slot] = false;
+      starKeyCheck[slot] = false;
+      writeAccessCode[slot] = false;
+    }
+
+    #if defined(ESP32)
+    portEXIT_CRITICAL(&timer1Mux);
+    #else
+    interrupts();
+    #endif
   }
+}
 
-  // Sets the binary to write for virtual keypad keys
-  if (!writeKeyPending && (millis() - previousTime > 500 || millis() <= 500)) {
-    bool validKey = true;
 
-    // Skips writing to disabled partitions or partitions not specified in dscKeybusInterface.h
-    if (disabled[writePartition - 1] || dscPartitions < writePartition) {
-      switch (receivedKey) {
-        case '/': setPartition = true; validKey = false; break;
-      }
-      return;
+byte dscKeybusInterface::writeStatus(byte handle) {
+  const dscWriteCommand *command = writeCommand(handle);
+  if (command == NULL) return dscWriteUnknown;
+  return command->status;
+}
+
+
+const dscWriteCommand *dscKeybusInterface::writeCommand(byte handle) {
+  if (handle == 0) return NULL;
+  for (byte commandIndex = 0; commandIndex < dscWriteCommandSize; commandIndex++) {
+    if (writeCommands[commandIndex].handle == handle) return &writeCommands[commandIndex];
+  }
+  return NULL;
+}
+
+
+// Passes keys from the write buffer to dscClockInterrupt(), which writes a key for each partition in the same Keybus
+// cycle.  The buffer is read in order for the first waiting key of each partition, so the keys of a partition are
+// written in order while keys for other partitions are not held up waiting for them.
+void dscKeybusInterface::writeKeys() {
+
+  // Marks the keys written by dscClockInterrupt() in the write buffer, the last slot is for alarm keys
+  for (byte slot = 0; slot <= dscPartitions; slot++) {
+    if (writeSlotIndex[slot] == 0) continue;
+    bool keyPending = slot < dscPartitions ? writeKeyPending[slot] : writeAlarm;
+    if (!keyPending) {
+      writeBuffer[writeSlotIndex[slot] - 1] = dscWriteKeyWritten;
+      writeSlotIndex[slot] = 0;
     }
+  }
 
-    // Sets binary for virtual keypad keys
-    else {
-      switch (receivedKey) {
-        case '/': setPartition = true; validKey = false; break;
-        case '0': writeKey = 0x00; break;
-        case '1': writeKey = 0x05; break;
-        case '2': writeKey = 0x0A; break;
-        case '3': writeKey = 0x0F; break;
-        case '4': writeKey = 0x11; break;
-        case '5': writeKey = 0x16; break;
-        case '6': writeKey = 0x1B; break;
-        case '7': writeKey = 0x1C; break;
-        case '8': writeKey = 0x22; break;
-        case '9': writeKey = 0x27; break;
-        case '*': writeKey = 0x28; if (status[writePartition - 1] < 0x9E) starKeyCheck = true; break;
-        case '#': writeKey = 0x2D; break;
-        case 'f': case 'F': writeKey = 0xBB; writeAlarm = true; break;                           // Keypad fire alarm
-        case 'b': case 'B': writeKey = 0x82; break;                                              // Enter event buffer
-        case '>': writeKey = 0x87; break;                                                        // Event buffer right arrow
-        case '<': writeKey = 0x88; break;                                                        // Event buffer left arrow
-        case 'l': case 'L': writeKey = 0xA5; break;                                              // LCD keypad data request
-        case 's': case 'S': writeKey = 0xAF; writeAccessCode[writePartition - 1] = true; break;  // Arm stay
-        case 'w': case 'W': writeKey = 0xB1; writeAccessCode[writePartition - 1] = true; break;  // Arm away
-        case 'n': case 'N': writeKey = 0xB6; writeAccessCode[writePartition - 1] = true; break;  // Arm with no entry delay (night arm)
-        case 'a': case 'A': writeKey = 0xDD; writeAlarm = true; break;                           // Keypad auxiliary alarm
-        case 'c': case 'C': writeKey = 0xBB; break;                                              // Door chime
-        case 'r': case 'R': writeKey = 0xDA; break;                                              // Reset
-        case 'p': case 'P': writeKey = 0xEE; writeAlarm = true; break;                           // Keypad panic alarm
-        case 'x': case 'X': writeKey = 0xE1; break;                                              // Exit
-        case '[': writeKey = 0xD5; writeAccessCode[writePartition - 1] = true; break;            // Command output 1
-        case ']': writeKey = 0xDA; writeAccessCode[writePartition - 1] = true; break;            // Command output 2
-        case '{': writeKey = 0x70; writeAccessCode[writePartition - 1] = true; break;            // Command output 3
-        case '}': writeKey = 0xEC; writeAccessCode[writePartition - 1] = true; break;            // Command output 4
-        default: {
-          validKey = false;
-          break;
+  // Passes the first waiting key of each partition without a key being written
+  byte partition = writeHeadPartition;
+  byte partitionsWaiting = 0;  // Partitions with an earlier key in the buffer, 1 bit per partition
+  byte bufferIndex = writeBufferHead;
+  for (byte keyCount = 0; keyCount < writeBufferCount; keyCount++) {
+    byte bufferKey = writeBuffer[bufferIndex];
+
+    if (bufferKey < 0x80 || bufferKey == dscWriteKeyStarted) {
+      byte partitionBit = 1 << (partition - 1);
+      if (bufferKey < 0x80 && !(partitionsWaiting & partitionBit)) {
+
+        // Skips keys for disabled partitions or partitions not specified in dscKeybusInterface.h
+        if (dscPartitions < partition || disabled[partition - 1]) writeBuffer[bufferIndex] = dscWriteKeySkipped;
+        else {
+          if (!setWriteKey(partition, bufferKey)) break;  // Waits after alarm keys
+
+          // Invalid keys are marked as written
+          if (writeAlarm && writeSlotIndex[dscPartitions] == 0) {
+            writeSlotIndex[dscPartitions] = bufferIndex + 1;
+            writeBuffer[bufferIndex] = dscWriteKeyStarted;
+          }
+          else if (writeKeyPending[partition - 1] && writeSlotIndex[partition - 1] == 0) {
+            writeSlotIndex[partition - 1] = bufferIndex + 1;
+            writeBuffer[bufferIndex] = dscWriteKeyStarted;
+          }
+          else writeBuffer[bufferIndex] = dscWriteKeyWritten;
         }
       }
+      partitionsWaiting |= partitionBit;
     }
+    else if (bufferKey & 0x0F) partition = bufferKey & 0x0F;  // Selects the partition of the following keys
 
-    // Sets the writing position in dscClockInterrupt() for the currently set partition
-    switch (writePartition) {
-      case 1:
-      case 5: {
-        writeByte = 2;
-        writeBit = 9;
-        break;
-      }
-      case 2:
-      case 6: {
-        writeByte = 3;
-        writeBit = 17;
-        break;
-      }
-      case 3:
-      case 7: {
-        writeByte = 8;
-        writeBit = 57;
-        break;
-      }
-      case 4:
-      case 8: {
-        writeByte = 9;
-        writeBit = 65;
-        break;
-      }
-      default: {
-        writeByte = 2;
-        writeBit = 9;
-        break;
-      }
-    }
+    if (++bufferIndex == dscWriteBufferSize) bufferIndex = 0;
+  }
+
+  // Updates the tracked commands before the written and skipped keys are removed
+  if (writeCommandsPending) updateWriteCommands();
 
-    if (writeAlarm) previousTime = millis();  // Sets a marker to time writes after keypad alarm keys
-    if (validKey) {
-      writeKeyPending = true;                 // Sets a flag indicating that a write is pending, cleared by dscClockInterrupt()
-      writeReady = false;
+  // Removes written and skipped keys and partition selections from the head of the buffer
+  while (writeBufferCount > 0) {
+    byte bufferKey = writeBuffer[writeBufferHead];
+    if (bufferKey < 0x80 || bufferKey == dscWriteKeyStarted) break;
+    if (bufferKey & 0x0F) writeHeadPartition = bufferKey & 0x0F;
+
+    if (++writeBufferHead == dscWriteBufferSize) writeBufferHead = 0;
+    writeBufferCount--;
+  }
+}
+
+
+// Specifies the key value to be written by dscClockInterrupt() for an enabled partition, returns false if a previous
+// key for the partition or an alarm key is still being written.  Keys wait after an alarm key until
+// dscClockInterrupt() has repeated the alarm key for the panel 0x1C verification to resolve errors when additional
+// keys are sent immediately after alarm keys, or 500ms if the repeat is not written.
+bool dscKeybusInterface::setWriteKey(byte partition, const char receivedKey) {
+  if (writeAlarm) return false;
+  if (writeRepeat && millis() - writeAlarmTime <= 500) return false;
+
+  byte partitionIndex = partition - 1;
+  if (writeKeyPending[partitionIndex]) return false;
+
+  // Sets binary for virtual keypad keys
+  byte writeValue = 0;
+  bool validKey = true;
+  bool alarmKey = false;
+  switch (receivedKey) {
+    case '0': writeValue = 0x00; break;
+    case '1': writeValue = 0x05; break;
+    case '2': writeValue = 0x0A; break;
+    case '3': writeValue = 0x0F; break;
+    case '4': writeValue = 0x11; break;
+    case '5': writeValue = 0x16; break;
+    case '6': writeValue = 0x1B; break;
+    case '7': writeValue = 0x1C; break;
+    case '8': writeValue = 0x22; break;
+    case '9': writeValue = 0x27; break;
+    case '*': writeValue = 0x28; if (status[partitionIndex] < 0x9E) starKeyCheck[partitionIndex] = true; break;
+    case '#': writeValue = 0x2D; break;
+    case 'f': case 'F': writeValue = 0xBB; alarmKey = true; break;                         // Keypad fire alarm
+    case 'b': case 'B': writeValue = 0x82; break;                                          // Enter event buffer
+    case '>': writeValue = 0x87; break;                                                    // Event buffer right arrow
+    case '<': writeValue = 0x88; break;                                                    // Event buffer left arrow
+    case 'l': case 'L': writeValue = 0xA5; break;                                          // LCD keypad data request
+    case 's': case 'S': writeValue = 0xAF; writeAccessCode[partitionIndex] = true; break;  // Arm stay
+    case 'w': case 'W': writeValue = 0xB1; writeAccessCode[partitionIndex] = true; break;  // Arm away
+    case 'n': case 'N': writeValue = 0xB6; writeAccessCode[partitionIndex] = true; break;  // Arm with no entry delay (night arm)
+    case 'a': case 'A': writeValue = 0xDD; alarmKey = true; break;                         // Keypad auxiliary alarm
+    case 'c': case 'C': writeValue = 0xBB; break;                                          // Door chime
+    case 'r': case 'R': writeValue = 0xDA; break;                                          // Reset
+    case 'p': case 'P': writeValue = 0xEE; alarmKey = true; break;                         // Keypad panic alarm
+    case 'x': case 'X': writeValue = 0xE1; break;                                          // Exit
+    case '[': writeValue = 0xD5; writeAccessCode[partitionIndex] = true; break;            // Command output 1
+    case ']': writeValue = 0xDA; writeAccessCode[partitionIndex] = true; break;            // Command output 2
+    case '{': writeValue = 0x70; writeAccessCode[partitionIndex] = true; break;            // Command output 3
+    case '}': writeValue = 0xEC; writeAccessCode[partitionIndex] = true; break;            // Command output 4
+    default: {
+      validKey = false;
+      break;
     }
   }
+
+  // Sets a flag indicating that a write is pending, cleared by dscClockInterrupt() - the key is set first as the flag
+  // enables the write in the interrupt
+  if (alarmKey) {
+    writeAlarmTime = millis();  // Sets a marker to time writes after keypad alarm keys
+    #if defined(DSC_LATENCY_STATS)
+    writeAlarmVerifying = true;
+    #endif
+    writeAlarmKey = writeValue;
+    writeAlarm = true;
+    writeReady = false;
+  }
+  else if (validKey) {
+    writeKey[partitionIndex] = writeValue;
+    writeKeyPending[partitionIndex] = true;
+    writeReady = false;
+  }
+  return true;
 }
 
 
-#if defined(__AVR__)
+#if defined(__AVR__) || defined(DSC_NATIVE)
 bool dscKeybusInterface::redundantPanelData(byte previousCmd[], volatile byte currentCmd[], byte checkedBytes) {
 #elif defined(ESP8266)
 bool ICACHE_RAM_ATTR dscKeybusInterface::redundantPanelData(byte previousCmd[], volatile byte currentCmd[], byte checkedBytes) {
@@ -438,6 +955,59 @@ bool IRAM_ATTR dscKeybusInterface::redundantPanelData(byte previousCmd[], volati
 }
 
 
+// Returns the number of bytes used in the panel data buffer
+#if defined(__AVR__) || defined(DSC_NATIVE)
+dscBufferIndex dscKeybusInterface::panelBufferUsed() {
+#elif defined(ESP8266)
+dscBufferIndex ICACHE_RAM_ATTR dscKeybusInterface::panelBufferUsed() {
+#elif defined(ESP32)
+dscBufferIndex IRAM_ATTR dscKeybusInterface::panelBufferUsed() {
+#endif
+  dscBufferIndex bufferHead = panelBufferHead;
+  dscBufferIndex bufferTail = panelBufferTail;
+  if (bufferHead >= bufferTail) return bufferHead - bufferTail;
+  else return dscBufferBytes - bufferTail + bufferHead;
+}
+
+
+#if defined(DSC_ISR_STATS)
+// Copies the interrupt statistics without disabling interrupts - the copy is repeated if an interrupt updates the
+// statistics while they are being read
+void dscKeybusInterface::readInterruptStats(dscInterruptStats &stats) {
+  byte sequence;
+  do {
+    sequence = isrStatsSequence;
+    stats.clockInterrupt.count = isrStats.clockInterrupt.count;
+    stats.clockInterrupt.minCycles = isrStats.clockInterrupt.minCycles;
+    stats.clockInterrupt.maxCycles = isrStats.clockInterrupt.maxCycles;
+    stats.clockInterrupt.totalCycles = isrStats.clockInterrupt.totalCycles;
+    stats.dataInterrupt.count = isrStats.dataInterrupt.count;
+    stats.dataInterrupt.minCycles = isrStats.dataInterrupt.minCycles;
+    stats.dataInterrupt.maxCycles = isrStats.dataInterrupt.maxCycles;
+    stats.dataInterrupt.totalCycles = isrStats.dataInterrupt.totalCycles;
+    stats.framesCaptured = isrStats.framesCaptured;
+    stats.framesRedundant = isrStats.framesRedundant;
+    stats.bufferOverflows = isrStats.bufferOverflows;
+  } while (sequence != isrStatsSequence);
+}
+
+
+#if defined(__AVR__) || defined(DSC_NATIVE)
+void dscKeybusInterface::recordInterruptTiming(volatile dscInterruptTiming &timing, unsigned long cycles) {
+#elif defined(ESP8266)
+void ICACHE_RAM_ATTR dscKeybusInterface::recordInterruptTiming(volatile dscInterruptTiming &timing, unsigned long cycles) {
+#elif defined(ESP32)
+void IRAM_ATTR dscKeybusInterface::recordInterruptTiming(volatile dscInterruptTiming &timing, unsigned long cycles) {
+#endif
+  if (timing.count == 0 || cycles < timing.minCycles) timing.minCycles = cycles;
+  if (cycles > timing.maxCycles) timing.maxCycles = cycles;
+  timing.totalCycles += cycles;
+  timing.count++;
+  isrStatsSequence++;
+}
+#endif  // DSC_ISR_STATS
+
+
 bool dscKeybusInterface::validCRC() {
   byte byteCount = (panelBitCount - 1) / 8;
   int dataSum = 0;
@@ -451,7 +1021,7 @@ bool dscKeybusInterface::validCRC() {
 
 // Called as an interrupt when the DSC clock changes to write data for virtual keypad and setup timers to read
 // data after an interval.
-#if defined(__AVR__)
+#if defined(__AVR__) || defined(DSC_NATIVE)
 void dscKeybusInterface::dscClockInterrupt() {
 #elif defined(ESP8266)
 void ICACHE_RAM_ATTR dscKeybusInterface::dscClockInterrupt() {
@@ -463,8 +1033,20 @@ void IRAM_ATTR dscKeybusInterface::dscClockInterrupt() {
   // keypad data).  The following sets up a timer for each platform that will call dscDataInterrupt() in
   // 250us to read the data line.
 
+  // AVR Timer1 calls dscDataInterrupt() via ISR(TIMER1_COMPA_vect) 250us after the timestamp of the clock change
+  #if defined(__AVR__) && defined(DSC_TIMER1_CAPTURE)
+  uint16_t clockTicks = TCNT1;
+  OCR1A = clockTicks + 500;
+  TIFR1 = (1 << OCF1A);     // Clears a compare match from the previous clock change
+  TIMSK1 |= (1 << OCIE1A);
+
+  // Extends the timestamp with the overflow count, including an overflow pending while in this interrupt
+  unsigned int clockOverflows = timer1Overflows;
+  if ((TIFR1 & (1 << TOV1)) && clockTicks < 0x8000) clockOverflows++;
+  unsigned long clockTime = ((unsigned long)clockOverflows << 16) | clockTicks;
+
   // AVR Timer1 calls dscDataInterrupt() via ISR(TIMER1_OVF_vect) when the Timer1 counter overflows
-  #if defined(__AVR__)
+  #elif defined(__AVR__)
   TCNT1=61535;            // Timer1 counter start value, overflows at 65535 in 250us
   TCCR1B |= (1 << CS10);  // Sets the prescaler to 1
 
@@ -476,24 +1058,42 @@ void IRAM_ATTR dscKeybusInterface::dscClockInterrupt() {
   #elif defined(ESP32)
   timerStart(timer1);
   portENTER_CRITICAL(&timer1Mux);
+
+  // Native virtual timer calls dscDataInterrupt() in 250us
+  #elif defined(DSC_NATIVE)
+  nativeTimerStart(250);
+  #endif
+
+  #if defined(DSC_ISR_STATS)
+  unsigned long isrStartCycles = dscCycleCount();
   #endif
 
   static unsigned long previousClockHighTime;
   static bool skipData = false;
 
   // Panel sends data while the clock is high
-  if (digitalRead(dscClockPin) == HIGH) {
-    if (virtualKeypad) digitalWrite(dscWritePin, LOW);  // Restores the data line after a virtual keypad write
+  if (dscClockHigh()) {
+    if (virtualKeypad) dscWriteLow();  // Restores the data line after a virtual keypad write
+    #if defined(__AVR__) && defined(DSC_TIMER1_CAPTURE)
+    if (clockHighTime <= 1000) clockPeriod = (clockTime - previousClockHighTime) >> 1;  // Skips the reset between commands
+    previousClockHighTime = clockTime;
+    #else
     previousClockHighTime = micros();
+    #endif
   }
 
   // Keypads and modules send data while the clock is low
   else {
+    #if defined(__AVR__) && defined(DSC_TIMER1_CAPTURE)
+    clockHighTime = (clockTime - previousClockHighTime) >> 1;  // Converts Timer1 ticks to microseconds
+    #else
     clockHighTime = micros() - previousClockHighTime;  // Tracks the clock high time to find the reset between commands
+    #endif
 
     // Saves data and resets counters after the clock cycle is complete (high for at least 1ms)
     if (clockHighTime > 1000) {
-      keybusTime = millis();
+      unsigned long captureTime = millis();
+      keybusTime = captureTime;
 
       // Skips incomplete and redundant data from status commands - these are sent constantly on the keybus at a high
       // rate, so they are always skipped.  Checking is required in the ISR to prevent flooding the buffer.
@@ -511,27 +1111,82 @@ void IRAM_ATTR dscKeybusInterface::dscClockInterrupt() {
           break;
       }
 
-      // Stores new panel data in the panel buffer
+      #if defined(DSC_ISR_STATS)
+      if (skipData && isrPanelBitTotal >= 8) isrStats.framesRedundant++;
+      #endif
+
+      // Stores new panel data in the panel buffer as a record sized to the captured bytes - the record is written
+      // before the head index is advanced so that loop() only sees complete commands.  One byte is kept free to
+      // separate a full buffer from an empty buffer.
       currentCmd = isrPanelData[0];
-      if (panelBufferLength == dscBufferSize) bufferOverflow = true;
-      else if (!skipData && panelBufferLength < dscBufferSize) {
-        for (byte i = 0; i < dscReadSize; i++) panelBuffer[panelBufferLength][i] = isrPanelData[i];
-        panelBufferBitCount[panelBufferLength] = isrPanelBitTotal;
-        panelBufferByteCount[panelBufferLength] = isrPanelByteCount;
-        panelBufferLength++;
+      if (!skipData) {
+        byte recordBytes = isrPanelByteCount < dscReadSize ? isrPanelByteCount + 1 : dscReadSize;  // Includes trailing bits
+        dscBufferIndex bufferUsed = panelBufferUsed();
+        if (bufferUsed + recordBytes + 4 >= dscBufferBytes) {
+          bufferOverflow = true;
+          #if defined(DSC_ISR_STATS)
+          isrStats.bufferOverflows++;
+          #endif
+        }
+        else {
+          dscBufferIndex bufferIndex = panelBufferHead;
+          panelBuffer[bufferIndex] = isrPanelByteCount;
+          if (++bufferIndex == dscBufferBytes) bufferIndex = 0;
+          panelBuffer[bufferIndex] = isrPanelBitTotal;
+          if (++bufferIndex == dscBufferBytes) bufferIndex = 0;
+          panelBuffer[bufferIndex] = captureTime;
+          if (++bufferIndex == dscBufferBytes) bufferIndex = 0;
+          panelBuffer[bufferIndex] = captureTime >> 8;
+          if (++bufferIndex == dscBufferBytes) bufferIndex = 0;
+          for (byte i = 0; i < recordBytes; i++) {
+            panelBuffer[bufferIndex] = isrPanelData[i];
+            if (++bufferIndex == dscBufferBytes) bufferIndex = 0;
+          }
+          panelBufferHead = bufferIndex;
+
+          // Tracks the maximum buffer usage
+          bufferUsed += recordBytes + 4;
+          if (bufferUsed > bufferHighWater) bufferHighWater = bufferUsed;
+
+          #if defined(DSC_ISR_STATS)
+          isrStats.framesCaptured++;
+          #endif
+        }
       }
 
       if (processModuleData) {
 
-        // Stores new keypad and module data - this data is not buffered
+        // Stores new keypad and module data in the module buffer as a record sized to the captured bytes, with the
+        // panel command and subcommand that the keypad or module responded to
         if (moduleDataDetected) {
-          moduleCmd = isrPanelData[0];
-          moduleSubCmd = isrPanelData[2];
           moduleDataDetected = false;
-          moduleDataCaptured = true;  // Sets a flag for handleModule()
-          for (byte i = 0; i < dscReadSize; i++) moduleData[i] = isrModuleData[i];
-          moduleBitCount = isrPanelBitTotal;
-          moduleByteCount = isrPanelByteCount;
+
+          byte recordBytes = isrPanelByteCount < dscReadSize ? isrPanelByteCount + 1 : dscReadSize;  // Includes trailing bits
+          dscBufferIndex bufferHead = moduleBufferHead;
+          dscBufferIndex bufferTail = moduleBufferTail;
+          dscBufferIndex bufferUsed;
+          if (bufferHead >= bufferTail) bufferUsed = bufferHead - bufferTail;
+          else bufferUsed = dscModuleBufferBytes - bufferTail + bufferHead;
+
+          if (bufferUsed + recordBytes + 4 >= dscModuleBufferBytes) {
+            if (moduleBufferOverflows < 255) moduleBufferOverflows++;
+          }
+          else {
+            dscBufferIndex bufferIndex = bufferHead;
+            moduleBuffer[bufferIndex] = isrPanelData[0];
+            if (++bufferIndex == dscModuleBufferBytes) bufferIndex = 0;
+            moduleBuffer[bufferIndex] = isrPanelData[2];
+            if (++bufferIndex == dscModuleBufferBytes) bufferIndex = 0;
+            moduleBuffer[bufferIndex] = isrPanelByteCount;
+            if (++bufferIndex == dscModuleBufferBytes) bufferIndex = 0;
+            moduleBuffer[bufferIndex] = isrPanelBitTotal;
+            if (++bufferIndex == dscModuleBufferBytes) bufferIndex = 0;
+            for (byte i = 0; i < recordBytes; i++) {
+              moduleBuffer[bufferIndex] = isrModuleData[i];
+              if (++bufferIndex == dscModuleBufferBytes) bufferIndex = 0;
+            }
+            moduleBufferHead = bufferIndex;
+          }
         }
 
         // Resets the keypad and module capture data
@@ -549,65 +1204,82 @@ void IRAM_ATTR dscKeybusInterface::dscClockInterrupt() {
     // Virtual keypad
     if (virtualKeypad) {
 
-      static bool writeStart = false;
-      static bool writeRepeat = false;
-      static bool writeCmd = false;
-
-      if (writePartition <= 4 && statusCmd == 0x05) writeCmd = true;
-      else if (writePartition >= 5 && statusCmd == 0x1B) writeCmd = true;
-      else writeCmd = false;
-
       // Writes a F/A/P alarm key and repeats the key on the next immediate command from the panel (0x1C verification)
-      if ((writeAlarm && writeKeyPending) || writeRepeat) {
+      if (writeAlarm || writeRepeat) {
 
         // Writes the first bit by shifting the alarm key data right 7 bits and checking bit 0
         if (isrPanelBitTotal == 0) {
-          if (!((writeKey >> 7) & 0x01)) {
-            digitalWrite(dscWritePin, HIGH);
+          if (!((writeAlarmKey >> 7) & 0x01)) {
+            dscWriteHigh();
           }
           writeStart = true;  // Resolves a timing issue where some writes do not begin at the correct bit
         }
 
         // Writes the remaining alarm key data
         else if (writeStart && isrPanelBitTotal <= 7) {
-          if (!((writeKey >> (7 - isrPanelBitTotal)) & 0x01)) digitalWrite(dscWritePin, HIGH);
+          if (!((writeAlarmKey >> (7 - isrPanelBitTotal)) & 0x01)) dscWriteHigh();
 
           // Resets counters when the write is complete
           if (isrPanelBitTotal == 7) {
-            writeKeyPending = false;
             writeStart = false;
-            writeAlarm = false;
 
-            // Sets up a repeated write for alarm keys
+            // Sets up a repeated write for alarm keys, the repeat completes the 0x1C verification and ends the wait
+            // for the next key in setWriteKey()
             if (!writeRepeat) writeRepeat = true;
-            else writeRepeat = false;
+            else {
+              writeRepeat = false;
+              #if defined(DSC_LATENCY_STATS)
+              writeRepeatTime = millis();
+              #endif
+            }
+            writeAlarm = false;
           }
         }
       }
 
-      // Writes a regular key unless waiting for a response to the '*' key or the panel is sending a query command
-      else if (writeKeyPending && !starKeyWait[writePartition - 1] && isrPanelByteCount == writeByte && writeCmd) {
-
-        // Writes the first bit by shifting the key data right 7 bits and checking bit 0
-        if (isrPanelBitTotal == writeBit) {
-          if (!((writeKey >> 7) & 0x01)) digitalWrite(dscWritePin, HIGH);
-          writeStart = true;  // Resolves a timing issue where some writes do not begin at the correct bit
+      // Writes regular keys during status commands: each partition has a key position in the status command, bytes 2,
+      // 3, 8, 9 for partitions 1-4 in 0x05 and partitions 5-8 in 0x1B, so keys for several partitions are written in
+      // the same command.  Skips partitions waiting for a response to the '*' key.
+      else if (statusCmd) {
+        byte partitionIndex;
+        switch (isrPanelByteCount) {
+          case 2: partitionIndex = 0; break;
+          case 3: partitionIndex = 1; break;
+          case 8: partitionIndex = 2; break;
+          case 9: partitionIndex = 3; break;
+          default: partitionIndex = 8; break;
         }
+        if (statusCmd == 0x1B) partitionIndex += 4;
 
-        // Writes the remaining key data
-        else if (writeStart && isrPanelBitTotal > writeBit && isrPanelBitTotal <= writeBit + 7) {
-          if (!((writeKey >> (7 - isrPanelBitCount)) & 0x01)) digitalWrite(dscWritePin, HIGH);
+        if (partitionIndex < dscPartitions && writeKeyPending[partitionIndex] && !starKeyWait[partitionIndex]) {
+          byte writeBit = ((isrPanelByteCount - 1) * 8) + 1;  // Bit of the Keybus command to start writing
 
-          // Resets counters when the write is complete
-          if (isrPanelBitTotal == writeBit + 7) {
-            if (starKeyCheck) starKeyWait[writePartition - 1] = true;  // Handles waiting until the panel is ready after pressing '*'
-            else writeKeyPending = false;
-            writeStart = false;
+          // Writes the first bit by shifting the key data right 7 bits and checking bit 0
+          if (isrPanelBitTotal == writeBit) {
+            if (!((writeKey[partitionIndex] >> 7) & 0x01)) dscWriteHigh();
+            writeStart = true;  // Resolves a timing issue where some writes do not begin at the correct bit
+          }
+
+          // Writes the remaining key data
+          else if (writeStart && isrPanelBitTotal > writeBit && isrPanelBitTotal <= writeBit + 7) {
+            if (!((writeKey[partitionIndex] >> (7 - isrPanelBitCount)) & 0x01)) dscWriteHigh();
+
+            // Resets counters when the write is complete
+            if (isrPanelBitTotal == writeBit + 7) {
+              if (starKeyCheck[partitionIndex]) starKeyWait[partitionIndex] = true;  // Handles waiting until the panel is ready after pressing '*'
+              else writeKeyPending[partitionIndex] = false;
+              writeStart = false;
+            }
           }
         }
       }
     }
   }
+
+  #if defined(DSC_ISR_STATS)
+  recordInterruptTiming(isrStats.clockInterrupt, dscCycleElapsed(isrStartCycles));
+  #endif
+
   #if defined(ESP32)
   portEXIT_CRITICAL(&timer1Mux);
   #endif
@@ -615,7 +1287,7 @@ void IRAM_ATTR dscKeybusInterface::dscClockInterrupt() {
 
 
 // Interrupt function called by AVR Timer1, esp8266 timer1, and esp32 timer1 after 250us to read the data line
-#if defined(__AVR__)
+#if defined(__AVR__) || defined(DSC_NATIVE)
 void dscKeybusInterface::dscDataInterrupt() {
 #elif defined(ESP8266)
 void ICACHE_RAM_ATTR dscKeybusInterface::dscDataInterrupt() {
@@ -625,15 +1297,19 @@ void IRAM_ATTR dscKeybusInterface::dscDataInterrupt() {
   portENTER_CRITICAL(&timer1Mux);
 #endif
 
+  #if defined(DSC_ISR_STATS)
+  unsigned long isrStartCycles = dscCycleCount();
+  #endif
+
   // Panel sends data while the clock is high
-  if (digitalRead(dscClockPin) == HIGH) {
+  if (dscClockHigh()) {
 
     // Reads panel data and sets data counters
     if (isrPanelByteCount < dscReadSize) {  // Limits Keybus data bytes to dscReadSize
       if (isrPanelBitCount < 8) {
         // Data is captured in each byte by shifting left by 1 bit and writing to bit 0
         isrPanelData[isrPanelByteCount] <<= 1;
-        if (digitalRead(dscReadPin) == HIGH) {
+        if (dscReadHigh()) {
           isrPanelData[isrPanelByteCount] |= 1;
         }
       }
@@ -672,13 +1348,13 @@ void IRAM_ATTR dscKeybusInterface::dscDataInterrupt() {
   // Keypads and modules send data while the clock is low
   else {
 
-    // Keypad and module data is not buffered and skipped if the panel data buffer is filling
-    if (processModuleData && isrPanelByteCount < dscReadSize && panelBufferLength <= 1) {
+    // Keypad and module data is buffered separately from panel data in dscClockInterrupt()
+    if (processModuleData && isrPanelByteCount < dscReadSize) {
 
       // Data is captured in each byte by shifting left by 1 bit and writing to bit 0
       if (isrPanelBitCount < 8) {
         isrModuleData[isrPanelByteCount] <<= 1;
-        if (digitalRead(dscReadPin) == HIGH) {
+        if (dscReadHigh()) {
           isrModuleData[isrPanelByteCount] |= 1;
         }
         else {
@@ -692,6 +1368,11 @@ void IRAM_ATTR dscKeybusInterface::dscDataInterrupt() {
       }
     }
   }
+
+  #if defined(DSC_ISR_STATS)
+  recordInterruptTiming(isrStats.dataInterrupt, dscCycleElapsed(isrStartCycles));
+  #endif
+
   #if defined(ESP32)
   portEXIT_CRITICAL(&timer1Mux);
   #endif
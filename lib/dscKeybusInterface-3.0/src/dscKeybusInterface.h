@@ -165,44 +165,88 @@ ISR(TIMER1_OVF_vect) {
 byte dscKeybusInterface::dscClockPin;
 byte dscKeybusInterface::dscReadPin;
 byte dscKeybusInterface::dscWritePin;
-char dscKeybusInterface::writeKey;
+#if defined(__AVR__)
+volatile uint8_t * dscKeybusInterface::dscClockPort;
+volatile uint8_t * dscKeybusInterface::dscReadPort;
+volatile uint8_t * dscKeybusInterface::dscWritePort;
+uint8_t dscKeybusInterface::dscClockMask;
+uint8_t dscKeybusInterface::dscReadMask;
+uint8_t dscKeybusInterface::dscWriteMask;
+#endif
+char dscKeybusInterface::writeKey[dscPartitions];
+char dscKeybusInterface::writeAlarmKey;
 byte dscKeybusInterface::writePartition;
-byte dscKeybusInterface::writeByte;
-byte dscKeybusInterface::writeBit;
 bool dscKeybusInterface::virtualKeypad;
 bool dscKeybusInterface::processModuleData;
 byte dscKeybusInterface::panelData[dscReadSize];
+unsigned long dscKeybusInterface::panelTime;
 byte dscKeybusInterface::panelByteCount;
 byte dscKeybusInterface::panelBitCount;
-volatile bool dscKeybusInterface::writeKeyPending;
+volatile bool dscKeybusInterface::writeKeyPending[dscPartitions];
 volatile byte dscKeybusInterface::moduleData[dscReadSize];
-volatile bool dscKeybusInterface::moduleDataCaptured;
 volatile bool dscKeybusInterface::moduleDataDetected;
 volatile byte dscKeybusInterface::moduleByteCount;
 volatile byte dscKeybusInterface::moduleBitCount;
 volatile bool dscKeybusInterface::writeAlarm;
-volatile bool dscKeybusInterface::starKeyCheck;
+volatile bool dscKeybusInterface::writeRepeat;
+#if defined(DSC_LATENCY_STATS)
+volatile unsigned long dscKeybusInterface::writeRepeatTime;
+#endif
+volatile bool dscKeybusInterface::starKeyCheck[dscPartitions];
 volatile bool dscKeybusInterface::starKeyWait[dscPartitions];
+volatile bool dscKeybusInterface::writeStart;
 volatile bool dscKeybusInterface::bufferOverflow;
-volatile byte dscKeybusInterface::panelBufferLength;
-volatile byte dscKeybusInterface::panelBuffer[dscBufferSize][dscReadSize];
-volatile byte dscKeybusInterface::panelBufferBitCount[dscBufferSize];
-volatile byte dscKeybusInterface::panelBufferByteCount[dscBufferSize];
+volatile dscBufferIndex dscKeybusInterface::bufferHighWater;
+volatile dscBufferIndex dscKeybusInterface::panelBufferHead;
+volatile dscBufferIndex dscKeybusInterface::panelBufferTail;
+volatile byte dscKeybusInterface::panelBuffer[dscBufferBytes];
 volatile byte dscKeybusInterface::isrPanelData[dscReadSize];
 volatile byte dscKeybusInterface::isrPanelByteCount;
 volatile byte dscKeybusInterface::isrPanelBitCount;
 volatile byte dscKeybusInterface::isrPanelBitTotal;
 volatile byte dscKeybusInterface::isrModuleData[dscReadSize];
+volatile byte dscKeybusInterface::moduleBufferOverflows;
+volatile dscBufferIndex dscKeybusInterface::moduleBufferHead;
+volatile dscBufferIndex dscKeybusInterface::moduleBufferTail;
+volatile byte dscKeybusInterface::moduleBuffer[dscModuleBufferBytes];
 volatile byte dscKeybusInterface::currentCmd;
 volatile byte dscKeybusInterface::statusCmd;
 volatile byte dscKeybusInterface::moduleCmd;
 volatile byte dscKeybusInterface::moduleSubCmd;
 volatile unsigned long dscKeybusInterface::clockHighTime;
 volatile unsigned long dscKeybusInterface::keybusTime;
+dscStatusHandler dscKeybusInterface::statusHandlers[dscEventTypes];
+dscPartitionState dscKeybusInterface::partitionState[dscPartitions];
+#if defined(DSC_ISR_STATS)
+volatile dscInterruptStats dscKeybusInterface::isrStats;
+volatile byte dscKeybusInterface::isrStatsSequence;
+#endif
+
+// Interrupt function called 250us after a clock change by the Timer1 output compare set in dscClockInterrupt(),
+// disables the compare interrupt and calls dscDataInterrupt() to read the data line.  Timer1 runs freely and the
+// overflow interrupt extends the clock timestamps.
+#if defined(__AVR__) && defined(DSC_TIMER1_CAPTURE)
+volatile unsigned int dscKeybusInterface::timer1Overflows;
+volatile unsigned long dscKeybusInterface::clockPeriod;
+
+ISR(TIMER1_COMPA_vect) {
+  TIMSK1 &= ~(1 << OCIE1A);  // Disables the Timer1 output compare interrupt
+  dscKeybusInterface::dscDataInterrupt();
+}
+
+ISR(TIMER1_OVF_vect) {
+  dscKeybusInterface::timer1Overflows++;
+}
 
 // Interrupt function called after 250us by dscClockInterrupt() using AVR Timer1, disables the timer and calls
 // dscDataInterrupt() to read the data line
-#if defined(__AVR__)
+#elif defined(__AVR__) && defined(DSC_ISR_STATS)
+ISR(TIMER1_OVF_vect) {
+  dscKeybusInterface::dscDataInterrupt();
+  TCCR1B = 0;  // Disables Timer1 after dscDataInterrupt() reads the Timer1 counter for interrupt timing
+}
+
+#elif defined(__AVR__)
 ISR(TIMER1_OVF_vect) {
   TCCR1B = 0;  // Disables Timer1
   dscKeybusInterface::dscDataInterrupt();
@@ -28,6 +28,51 @@
  */
 
 #include "dscKeybus.h"
+#include <stddef.h>
+
+// Status flags set by a partition status message: the flags updated by the message in the high byte and their values
+// in the low byte
+constexpr uint16_t dscStatusUpdate(byte flagMask, byte flagValues) {
+  return (flagMask << 8) | flagValues;
+}
+
+constexpr uint16_t dscStatusMessageFlags(byte message) {
+  return
+    (message == 0x01 || message == 0x02) ?  // Partition ready, stay/away zones open
+      dscStatusUpdate(dscReadyFlag | dscEntryDelayFlag | dscArmedFlags | dscAlarmFlag, dscReadyFlag) :
+    (message == 0x03) ?  // Zones open
+      dscStatusUpdate(dscReadyFlag | dscEntryDelayFlag, 0) :
+    (message == 0x04) ?  // Armed stay
+      dscStatusUpdate(dscArmedFlags | dscReadyFlag | dscExitDelayFlag | dscEntryDelayFlag, dscArmedFlag | dscArmedStayFlag) :
+    (message == 0x05) ?  // Armed away
+      dscStatusUpdate(dscArmedFlags | dscReadyFlag | dscExitDelayFlag | dscEntryDelayFlag, dscArmedFlag | dscArmedAwayFlag) :
+    (message == 0x06 || message == 0x16) ?  // Armed with no entry delay
+      dscStatusUpdate(dscArmedFlag | dscNoEntryDelayFlag | dscReadyFlag, dscArmedFlag | dscNoEntryDelayFlag) :
+    (message == 0x08) ?  // Exit delay in progress
+      dscStatusUpdate(dscExitDelayFlag | dscReadyFlag, dscExitDelayFlag | dscReadyFlag) :
+    (message == 0x09 || message == 0x15) ?  // Arming with no entry delay, arming with bypassed zones
+      dscStatusUpdate(dscReadyFlag, dscReadyFlag) :
+    (message == 0x0C) ?  // Entry delay in progress
+      dscStatusUpdate(dscReadyFlag | dscEntryDelayFlag, dscEntryDelayFlag) :
+    (message == 0x11) ?  // Partition in alarm
+      dscStatusUpdate(dscReadyFlag | dscEntryDelayFlag | dscAlarmFlag, dscAlarmFlag) :
+    (message == 0x3D) ?  // Partition disarmed
+      dscStatusUpdate(dscExitDelayFlag | dscEntryDelayFlag | dscArmedFlags | dscAlarmFlag, 0) :
+    (message == 0x3E) ?  // Partition disarmed, ready
+      dscStatusUpdate(dscReadyFlag | dscExitDelayFlag | dscEntryDelayFlag | dscArmedFlags | dscAlarmFlag, dscReadyFlag) :
+    (message == 0x8F) ?  // Invalid access code, ready is set in processPanelStatus() if not armed
+      dscStatusUpdate(0, 0) :
+      dscStatusUpdate(dscReadyFlag, 0);
+}
+
+#define dscStatusMessages4(message) dscStatusMessageFlags(message), dscStatusMessageFlags(message + 1), dscStatusMessageFlags(message + 2), dscStatusMessageFlags(message + 3)
+#define dscStatusMessages16(message) dscStatusMessages4(message), dscStatusMessages4(message + 4), dscStatusMessages4(message + 8), dscStatusMessages4(message + 12)
+#define dscStatusMessages64(message) dscStatusMessages16(message), dscStatusMessages16(message + 16), dscStatusMessages16(message + 32), dscStatusMessages16(message + 48)
+
+// Status flag updates for each partition status message, generated at compile time
+const uint16_t dscStatusMessageTable[256] PROGMEM = {
+  dscStatusMessages64(0x00), dscStatusMessages64(0x40), dscStatusMessages64(0x80), dscStatusMessages64(0xC0)
+};
 
 
 // Resets the state of all status components as changed for sketches to get the current status
@@ -38,12 +83,9 @@ void dscKeybusInterface::resetStatus() {
   powerChanged = true;
   batteryChanged = true;
   for (byte partition = 0; partition < dscPartitions; partition++) {
-    readyChanged[partition] = true;
-    armedChanged[partition] = true;
-    alarmChanged[partition] = true;
-    fireChanged[partition] = true;
-    disabled[partition] = true;
+    partitionState[partition].changed |= dscReadyChanged | dscArmedChanged | dscAlarmChanged | dscFireChanged | dscDisabledChanged;
   }
+  statusCached = 0;  // Processes all partitions on the next status command
   openZonesStatusChanged = true;
   alarmZonesStatusChanged = true;
   for (byte zoneGroup = 0; zoneGroup < dscZones; zoneGroup++) {
@@ -52,24 +94,19 @@ void dscKeybusInterface::resetStatus() {
   }
   pgmOutputsChanged[0] = 0xFF;
   pgmOutputsChanged[1] = 0x3F;
+
+  // Replaces any queued status events with dscEventResync
+  statusEventCount = 0;
+  statusEventsDropped = true;
 }
 
 
 // Sets the panel time
 bool dscKeybusInterface::setTime(unsigned int year, byte month, byte day, byte hour, byte minute, const char* accessCode, byte timePartition) {
-
-  // Loops if a previous write is in progress
-  while(writeKeyPending || writeKeysPending) {
-    loop();
-    #if defined(ESP8266)
-    yield();
-    #endif
-  }
-
   if (!ready[0]) return false;  // Skips if partition 1 is not ready
 
   if (hour > 23 || minute > 59 || month > 12 || day > 31 || year > 2099 || (year > 99 && year < 1900)) return false;  // Skips if input date/time is invalid
-  static char timeEntry[21];
+  char timeEntry[21];
   strcpy(timeEntry, "*6");
   strcat(timeEntry, accessCode);
   strcat(timeEntry, "1");
@@ -99,20 +136,138 @@ bool dscKeybusInterface::setTime(unsigned int year, byte month, byte day, byte h
 
   strcat(timeEntry, "#");
 
-  if (writePartition != timePartition) {
-    byte previousPartition = writePartition;
-    writePartition = timePartition;
-    write(timeEntry);
-    while(writeKeyPending || writeKeysPending) {
-      loop();
-      #if defined(ESP8266)
-      yield();
-      #endif
+  // The write buffer keeps the partition of the keys, so writePartition is restored once the keys are buffered
+  byte previousPartition = writePartition;
+  writePartition = timePartition;
+  bool timeWritten = write(timeEntry) != 0;
+  writePartition = previousPartition;
+
+  return timeWritten;
+}
+
+
+bool dscKeybusInterface::runMacro(const byte *macro, const char *accessCode) {
+  if (macroInstruction != NULL) return false;
+
+  macroInstruction = macro;
+  macroAccessCode = accessCode;
+  macroPartition = writePartition;
+  macroWaiting = false;
+  macroPrompt = false;
+  macroFirstKey = writeKeysQueued;
+  macroEndKey = writeKeysQueued;
+  macroTime = millis();
+  macroStatus = dscWriteInProgress;
+  processMacro();
+  return true;
+}
+
+
+void dscKeybusInterface::stopMacro() {
+  if (macroInstruction == NULL) return;
+  endMacro(dscWriteUnknown);
+}
+
+
+// Stops the macro and drops its keys that have not been written
+void dscKeybusInterface::endMacro(byte status) {
+  dropWriteKeys(macroFirstKey, macroEndKey);
+  macroInstruction = NULL;
+  macroStatus = status;
+}
+
+
+// Runs macro instructions from loop() until an instruction waits for the panel
+void dscKeybusInterface::processMacro() {
+  while (macroInstruction != NULL) {
+    byte instruction = pgm_read_byte(macroInstruction);
+
+    // Writes keys to the write buffer, waiting for room if it is full
+    char macroKey[2] = {(char)instruction, '\0'};
+    if (instruction >= ' ') {
+      if (queueMacroKeys(macroKey)) {
+        macroInstruction++;
+        macroTime = millis();
+        continue;
+      }
+    }
+
+    else if (instruction == dscMacroPartition) {
+      macroPartition = pgm_read_byte(macroInstruction + 1);
+      macroInstruction += 2;
+      continue;
+    }
+
+    // Waits until the preceding keys are written to the Keybus, then waits for the instruction
+    else if ((int16_t)(writeKeysQueued - writeBufferCount - macroEndKey) >= 0) {
+      if (!macroWaiting) {
+        macroWaiting = true;
+        macroTime = millis();
+      }
+
+      bool waitComplete = false;
+      byte instructionLength = 2;
+      switch (instruction) {
+        case dscMacroEnd: {
+          macroInstruction = NULL;
+          macroStatus = dscWriteWritten;
+          return;
+        }
+        case dscMacroWaitStatus: {
+          if (macroPartition <= dscPartitions && status[macroPartition - 1] == pgm_read_byte(macroInstruction + 1)) waitComplete = true;
+          break;
+        }
+        case dscMacroWaitPrompt: {
+          instructionLength = 1;
+          if (macroPrompt) {
+            if (macroAccessCode == NULL) {
+              macroPrompt = false;
+              waitComplete = true;
+            }
+            else if (queueMacroKeys(macroAccessCode)) waitComplete = true;
+          }
+          break;
+        }
+        case dscMacroDelay: {
+          if (millis() - macroTime >= pgm_read_byte(macroInstruction + 1) * 10UL) waitComplete = true;
+          break;
+        }
+        default: {  // Stops at an invalid instruction
+          endMacro(dscWriteTimedOut);
+          return;
+        }
+      }
+
+      if (waitComplete) {
+        macroInstruction += instructionLength;
+        macroWaiting = false;
+        macroTime = millis();
+        continue;
+      }
     }
-    writePartition = previousPartition;
+
+    // Stops the macro if the panel does not respond
+    if (millis() - macroTime > dscMacroTimeout) endMacro(dscWriteTimedOut);
+    return;
   }
-  else write(timeEntry);
+}
+
+
+// Copies keys for the macro partition to the write buffer, returns false without writing any keys if they do not fit.
+// The waiting macro keys are kept together in the write buffer so that endMacro() can drop them: if the sketch has
+// written keys after them, the macro waits until they are written before adding more keys.
+bool dscKeybusInterface::queueMacroKeys(const char *keys) {
+  if (writeBufferCount + strlen(keys) + 1 > dscWriteBufferSize) return false;
+  if ((int16_t)(writeKeysQueued - writeBufferCount - macroEndKey) >= 0) macroFirstKey = writeKeysQueued;
+  else if (writeKeysQueued != macroEndKey) return false;
+
+  byte previousPartition = writePartition;
+  writePartition = macroPartition;
+  for (byte keyIndex = 0; keys[keyIndex] != '\0'; keyIndex++) queueWriteKey(keys[keyIndex]);
+  writePartition = previousPartition;
 
+  macroEndKey = writeKeysQueued;
+  macroPrompt = false;
   return true;
 }
 
@@ -127,6 +282,7 @@ void dscKeybusInterface::processPanelStatus() {
     if (trouble != previousTrouble) {
       previousTrouble = trouble;
       troubleChanged = true;
+      pushStatusEvent(dscEventTrouble, 0, trouble);
       if (!pauseStatus) statusChanged = true;
     }
   }
@@ -158,98 +314,75 @@ void dscKeybusInterface::processPanelStatus() {
       messageByte = ((partitionIndex - 4) * 2) + 3;
     }
 
-    // Partition disabled status
-    if (panelData[messageByte] == 0xC7) {
-      disabled[partitionIndex] = true;
-      processReadyStatus(partitionIndex, false);
+    // Skips partitions with the same lights and status as the last processed status command, unless a virtual keypad
+    // write is waiting for the partition status
+    byte partitionBit = 1 << partitionIndex;
+    if ((statusCached & partitionBit) && panelData[statusByte] == lights[partitionIndex] && panelData[messageByte] == status[partitionIndex]
+        && !starKeyWait[partitionIndex] && !writeAccessCode[partitionIndex]) {
+      partitionStatusSkipped++;
+      continue;
     }
-    else disabled[partitionIndex] = false;
-    if (disabled[partitionIndex] != previousDisabled[partitionIndex]) {
-      previousDisabled[partitionIndex] = disabled[partitionIndex];
+    statusCached |= partitionBit;
+
+    // Partition disabled status
+    bool partitionDisabled = panelData[messageByte] == 0xC7;
+    if (partitionDisabled != disabled[partitionIndex]) {
+      disabled[partitionIndex] = partitionDisabled;
       disabledChanged[partitionIndex] = true;
+      pushStatusEvent(dscEventDisabled, partitionIndex, disabled[partitionIndex]);
       if (!pauseStatus) statusChanged = true;
     }
 
     // Status lights
-    lights[partitionIndex] = panelData[statusByte];
-    if (lights[partitionIndex] != previousLights[partitionIndex]) {
-      previousLights[partitionIndex] = lights[partitionIndex];
+    if (panelData[statusByte] != lights[partitionIndex]) {
+      lights[partitionIndex] = panelData[statusByte];
       if (!pauseStatus) statusChanged = true;
     }
 
     // Status messages
-    status[partitionIndex] = panelData[messageByte];
-    if (status[partitionIndex] != previousStatus[partitionIndex]) {
-      previousStatus[partitionIndex] = status[partitionIndex];
+    if (panelData[messageByte] != status[partitionIndex]) {
+      status[partitionIndex] = panelData[messageByte];
       if (!pauseStatus) statusChanged = true;
     }
 
     // Fire status
     if (panelData[messageByte] < 0x12) {  // Ignores fire light status in intermittent states
-      if (bitRead(panelData[statusByte],6)) fire[partitionIndex] = true;
-      else fire[partitionIndex] = false;
-      if (fire[partitionIndex] != previousFire[partitionIndex]) {
-        previousFire[partitionIndex] = fire[partitionIndex];
+      bool partitionFire = bitRead(panelData[statusByte],6);
+      if (partitionFire != fire[partitionIndex]) {
+        fire[partitionIndex] = partitionFire;
         fireChanged[partitionIndex] = true;
+        pushStatusEvent(dscEventFire, partitionIndex, fire[partitionIndex]);
         if (!pauseStatus) statusChanged = true;
       }
     }
 
-    // Messages
-    switch (panelData[messageByte]) {
-
-      // Ready
-      case 0x01:         // Partition ready
-      case 0x02: {       // Stay/away zones open
-        processReadyStatus(partitionIndex, true);
-        processEntryDelayStatus(partitionIndex, false);
-
-        armedStay[partitionIndex] = false;
-        armedAway[partitionIndex] = false;
-        armed[partitionIndex] = false;
-        if (armed[partitionIndex] != previousArmed[partitionIndex]) {
-          previousArmed[partitionIndex] = armed[partitionIndex];
-          armedChanged[partitionIndex] = true;
-          if (!pauseStatus) statusChanged = true;
-        }
-
-        processAlarmStatus(partitionIndex, false);
-        break;
-      }
+    // Messages - the ready, armed, exit/entry delay, alarm, and no entry delay status set by each message is looked up
+    // from dscStatusMessageTable[], the remaining status is set here
+    byte message = panelData[messageByte];
+    uint16_t messageFlags = pgm_read_word(&dscStatusMessageTable[message]);
+    byte flagMask = messageFlags >> 8;
+    byte flagValues = messageFlags;
 
-      // Zones open
-      case 0x03: {
-        processReadyStatus(partitionIndex, false);
-        processEntryDelayStatus(partitionIndex, false);
-        break;
-      }
+    switch (message) {
 
       // Armed
       case 0x04:         // Armed stay
       case 0x05: {       // Armed away
-        if (panelData[messageByte] == 0x04) {
-          armedStay[partitionIndex] = true;
-          armedAway[partitionIndex] = false;
-        }
-        else {
-          armedStay[partitionIndex] = false;
-          armedAway[partitionIndex] = true;
-        }
-
         writeAccessCode[partitionIndex] = false;
+        exitState[partitionIndex] = 0;
+        break;
+      }
 
-        armed[partitionIndex] = true;
-        if (armed[partitionIndex] != previousArmed[partitionIndex] || armedStay[partitionIndex] != previousArmedStay[partitionIndex]) {
-          previousArmed[partitionIndex] = armed[partitionIndex];
-          previousArmedStay[partitionIndex] = armedStay[partitionIndex];
-          armedChanged[partitionIndex] = true;
-          if (!pauseStatus) statusChanged = true;
-        }
+      // Partition armed with no entry delay
+      case 0x06:
+      case 0x16: {
 
-        processReadyStatus(partitionIndex, false);
-        processExitDelayStatus(partitionIndex, false);
-        exitState[partitionIndex] = 0;
-        processEntryDelayStatus(partitionIndex, false);
+        // Sets an armed mode if not already set, used if interface is initialized while the panel is armed
+        if (!(partitionState[partitionIndex].flags & (dscArmedStayFlag | dscArmedAwayFlag))) {
+          flagMask |= dscArmedStayFlag | dscArmedAwayFlag;
+          if (message == 0x06) flagValues |= dscArmedStayFlag;
+          else flagValues |= dscArmedAwayFlag;
+        }
         break;
       }
 
@@ -257,88 +390,41 @@ void dscKeybusInterface::processPanelStatus() {
       case 0x08: {
         writeAccessCode[partitionIndex] = false;
 
-        processExitDelayStatus(partitionIndex, true);
-
         if (exitState[partitionIndex] != DSC_EXIT_NO_ENTRY_DELAY) {
           if (bitRead(lights[partitionIndex],3)) exitState[partitionIndex] = DSC_EXIT_STAY;
           else exitState[partitionIndex] = DSC_EXIT_AWAY;
-          if (exitState[partitionIndex] != previousExitState[partitionIndex]) {
-            previousExitState[partitionIndex] = exitState[partitionIndex];
+          dscPartitionState &state = partitionState[partitionIndex];
+          byte previousExitState = (state.other & dscPreviousExitState) >> 4;
+          if (exitState[partitionIndex] != previousExitState) {
+            state.other = (state.other & ~dscPreviousExitState) | (exitState[partitionIndex] << 4);
             exitDelayChanged[partitionIndex] = true;
             exitStateChanged[partitionIndex] = true;
+            pushStatusEvent(dscEventExitState, partitionIndex, exitState[partitionIndex]);
             if (!pauseStatus) statusChanged = true;
           }
         }
-
-        processReadyStatus(partitionIndex, true);
         break;
       }
 
       // Arming with no entry delay
       case 0x09: {
-        processReadyStatus(partitionIndex, true);
         exitState[partitionIndex] = DSC_EXIT_NO_ENTRY_DELAY;
         break;
       }
 
-      // Entry delay in progress
-      case 0x0C: {
-        processReadyStatus(partitionIndex, false);
-        processEntryDelayStatus(partitionIndex, true);
-        break;
-      }
-
-      // Partition in alarm
-      case 0x11: {
-        processReadyStatus(partitionIndex, false);
-        processEntryDelayStatus(partitionIndex, false);
-        processAlarmStatus(partitionIndex, true);
-        break;
-      }
-
-      // Arming with bypassed zones
-      case 0x15: {
-        processReadyStatus(partitionIndex, true);
-        break;
-      }
-
-      // Partition armed with no entry delay
-      case 0x06:
-      case 0x16: {
-        armed[partitionIndex] = true;
-
-        // Sets an armed mode if not already set, used if interface is initialized while the panel is armed
-        if (!armedStay[partitionIndex] && !armedAway[partitionIndex]) {
-          if (panelData[messageByte] == 0x06) {
-            armedStay[partitionIndex] = true;
-            previousArmedStay[partitionIndex] = armedStay[partitionIndex];
-          }
-          else armedAway[partitionIndex] = true;
-        }
-
-        processNoEntryDelayStatus(partitionIndex, true);
-        processReadyStatus(partitionIndex, false);
-        break;
-      }
-
       // Partition disarmed
       case 0x3D:
       case 0x3E: {
-        if (panelData[messageByte] == 0x3E) {  // Sets ready only during Partition disarmed
-          processReadyStatus(partitionIndex, true);
-        }
-
-        processExitDelayStatus(partitionIndex, false);
         exitState[partitionIndex] = 0;
-        processEntryDelayStatus(partitionIndex, false);
-        processArmed(partitionIndex, false);
-        processAlarmStatus(partitionIndex, false);
         break;
       }
 
       // Invalid access code
       case 0x8F: {
-        if (!armed[partitionIndex]) processReadyStatus(partitionIndex, true);
+        if (!(partitionState[partitionIndex].flags & dscArmedFlag)) {
+          flagMask = dscReadyFlag;
+          flagValues = dscReadyFlag;
+        }
         break;
       }
 
@@ -347,30 +433,34 @@ void dscKeybusInterface::processPanelStatus() {
       case 0xB8: {
         if (starKeyWait[partitionIndex]) {  // Resets the flag that waits for panel status 0x9E, 0xB8 after '*' is pressed
           starKeyWait[partitionIndex] = false;
-          starKeyCheck = false;
-          writeKeyPending = false;
+          starKeyCheck[partitionIndex] = false;
+          writeKeyPending[partitionIndex] = false;
         }
-        processReadyStatus(partitionIndex, false);
         break;
       }
 
       // Enter access code
       case 0x9F: {
+
+        // A running macro with an access code answers prompts for its partition instead of the sketch
+        bool macroAccessCodePrompt = false;
+        if (macroInstruction != NULL && partitionIndex == macroPartition - 1) {
+          macroPrompt = true;
+          macroAccessCodePrompt = macroAccessCode != NULL;
+        }
+
         if (writeAccessCode[partitionIndex]) {  // Ensures access codes are only sent when an arm or command output key is sent through this interface
           writeAccessCode[partitionIndex] = false;
-          accessCodePrompt = true;
-          if (!pauseStatus) statusChanged = true;
+          if (!macroAccessCodePrompt) {
+            accessCodePrompt = true;
+            if (!pauseStatus) statusChanged = true;
+          }
         }
-
-        processReadyStatus(partitionIndex, false);
-        break;
-      }
-
-      default: {
-        processReadyStatus(partitionIndex, false);
         break;
       }
     }
+
+    processStatusFlags(partitionIndex, flagMask, flagValues);
   }
 }
 
@@ -387,48 +477,35 @@ void dscKeybusInterface::processPanel_0x16() {
 void dscKeybusInterface::processPanel_0x27() {
   if (!validCRC()) return;
 
-  // Messages
-  for (byte partitionIndex = 0; partitionIndex < 2; partitionIndex++) {
+  // Messages for partitions 1-2, limited to the partitions specified in dscKeybusInterface.h
+  byte partitionCount = 2;
+  if (dscPartitions < partitionCount) partitionCount = dscPartitions;
+  for (byte partitionIndex = 0; partitionIndex < partitionCount; partitionIndex++) {
     byte messageByte = (partitionIndex * 2) + 3;
 
     // Armed
-    if (panelData[messageByte] == 0x04 || panelData[messageByte] == 0x05) {
-
-      processReadyStatus(partitionIndex, false);
-
-      if (panelData[messageByte] == 0x04) {
-        armedStay[partitionIndex] = true;
-        armedAway[partitionIndex] = false;
-      }
-      else if (panelData[messageByte] == 0x05) {
-        armedStay[partitionIndex] = false;
-        armedAway[partitionIndex] = true;
-      }
-
-      armed[partitionIndex] = true;
-
-      processExitDelayStatus(partitionIndex, false);
+    if (panelData[messageByte] == 0x04) {
+      processStatusFlags(partitionIndex, dscArmedFlags | dscReadyFlag | dscExitDelayFlag, dscArmedFlag | dscArmedStayFlag);
+      exitState[partitionIndex] = 0;
+    }
+    else if (panelData[messageByte] == 0x05) {
+      processStatusFlags(partitionIndex, dscArmedFlags | dscReadyFlag | dscExitDelayFlag, dscArmedFlag | dscArmedAwayFlag);
       exitState[partitionIndex] = 0;
     }
 
     // Armed with no entry delay
     else if (panelData[messageByte] == 0x06 || panelData[messageByte] == 0x16) {
-      noEntryDelay[partitionIndex] = true;
+      byte flagMask = dscArmedFlag | dscNoEntryDelayFlag | dscReadyFlag | dscExitDelayFlag;
+      byte flagValues = dscArmedFlag | dscNoEntryDelayFlag;
 
       // Sets an armed mode if not already set, used if interface is initialized while the panel is armed
-      if (!armedStay[partitionIndex] && !armedAway[partitionIndex]) armedStay[partitionIndex] = true;
-
-      armed[partitionIndex] = true;
-      if (armed[partitionIndex] != previousArmed[partitionIndex]) {
-        previousArmed[partitionIndex] = armed[partitionIndex];
-        previousArmedStay[partitionIndex] = armedStay[partitionIndex];
-        armedChanged[partitionIndex] = true;
-        if (!pauseStatus) statusChanged = true;
+      if (!(partitionState[partitionIndex].flags & (dscArmedStayFlag | dscArmedAwayFlag))) {
+        flagMask |= dscArmedStayFlag;
+        flagValues |= dscArmedStayFlag;
       }
 
-      processExitDelayStatus(partitionIndex, false);
+      processStatusFlags(partitionIndex, flagMask, flagValues);
       exitState[partitionIndex] = 0;
-      processReadyStatus(partitionIndex, false);
     }
   }
 
@@ -488,9 +565,8 @@ void dscKeybusInterface::processPanel_0x87() {
       pgmOutputsStatusChanged = true;
       if (!pauseStatus) statusChanged = true;
 
-      for (byte pgmBit = 0; pgmBit < 8; pgmBit++) {
-        if (bitRead(pgmChanged, pgmBit)) bitWrite(pgmOutputsChanged[pgmByte], pgmBit, 1);
-      }
+      pgmOutputsChanged[pgmByte] |= pgmChanged;
+      pushStatusEvents(dscEventPgmOutput, (pgmByte * 8) + 1, pgmChanged, pgmOutputs[pgmByte]);
     }
   }
 }
@@ -509,6 +585,8 @@ void dscKeybusInterface::processPanel_0xA5() {
   }
 
   byte partition = panelData[3] >> 6;
+  logPanelEvent(partition, panelData[5] & 0x03, panelData[6]);
+
   switch (panelData[5] & 0x03) {
     case 0x00: processPanelStatus0(partition, 6); break;
     case 0x01: processPanelStatus1(partition, 6); break;
@@ -570,6 +648,7 @@ void dscKeybusInterface::processPanel_0xE6_0x1A() {
   if (powerTrouble != previousPower) {
     previousPower = powerTrouble;
     powerChanged = true;
+    pushStatusEvent(dscEventPower, 0, powerTrouble);
     if (!pauseStatus) statusChanged = true;
   }
 }
@@ -577,7 +656,7 @@ void dscKeybusInterface::processPanel_0xE6_0x1A() {
 
 void dscKeybusInterface::processPanel_0xEB() {
   if (!validCRC()) return;
-  if (dscPartitions < 3) return;
+  if (!dscExtendedStatus) return;
 
   processTime(3);
 
@@ -593,6 +672,7 @@ void dscKeybusInterface::processPanel_0xEB() {
     case 0x80: partition = 8; break;
     default: partition = 0; break;
   }
+  logPanelEvent(partition, panelData[7], panelData[8]);
 
   switch (panelData[7] & 0x07) {
     case 0x00: processPanelStatus0(partition, 8); break;
@@ -613,6 +693,7 @@ void dscKeybusInterface::processPanelStatus0(byte partition, byte panelByte) {
       // Keypad Fire alarm
       case 0x4E: {
         keypadFireAlarm = true;
+        pushStatusEvent(dscEventKeypadFireAlarm, 0, 1);
         if (!pauseStatus) statusChanged = true;
         return;
       }
@@ -620,6 +701,7 @@ void dscKeybusInterface::processPanelStatus0(byte partition, byte panelByte) {
       // Keypad Aux alarm
       case 0x4F: {
         keypadAuxAlarm = true;
+        pushStatusEvent(dscEventKeypadAuxAlarm, 0, 1);
         if (!pauseStatus) statusChanged = true;
         return;
       }
@@ -627,6 +709,7 @@ void dscKeybusInterface::processPanelStatus0(byte partition, byte panelByte) {
       // Keypad Panic alarm
       case 0x50: {
         keypadPanicAlarm = true;
+        pushStatusEvent(dscEventKeypadPanicAlarm, 0, 1);
         if (!pauseStatus) statusChanged =true;
         return;
       }
@@ -635,6 +718,7 @@ void dscKeybusInterface::processPanelStatus0(byte partition, byte panelByte) {
       case 0xE7: {
         batteryTrouble = true;
         batteryChanged = true;
+        pushStatusEvent(dscEventBattery, 0, batteryTrouble);
         if (!pauseStatus) statusChanged = true;
         return;
       }
@@ -645,6 +729,7 @@ void dscKeybusInterface::processPanelStatus0(byte partition, byte panelByte) {
         if (powerTrouble != previousPower) {
           previousPower = powerTrouble;
           powerChanged = true;
+          pushStatusEvent(dscEventPower, 0, powerTrouble);
           if (!pauseStatus) statusChanged = true;
         }
         return;
@@ -654,6 +739,7 @@ void dscKeybusInterface::processPanelStatus0(byte partition, byte panelByte) {
       case 0xEF: {
         batteryTrouble = false;
         batteryChanged = true;
+        pushStatusEvent(dscEventBattery, 0, batteryTrouble);
         if (!pauseStatus) statusChanged = true;
         return;
       }
@@ -664,6 +750,7 @@ void dscKeybusInterface::processPanelStatus0(byte partition, byte panelByte) {
         if (powerTrouble != previousPower) {
           previousPower = powerTrouble;
           powerChanged = true;
+          pushStatusEvent(dscEventPower, 0, powerTrouble);
           if (!pauseStatus) statusChanged = true;
         }
         return;
@@ -682,8 +769,7 @@ void dscKeybusInterface::processPanelStatus0(byte partition, byte panelByte) {
       panelData[panelByte] == 0xE6 ||                                    // Disarmed special: keyswitch/wireless key/DLS
       (panelData[panelByte] >= 0xC0 && panelData[panelByte] <= 0xE4)) {  // Disarmed by access code
 
-    noEntryDelay[partitionIndex] = false;
-    processArmed(partitionIndex, false);
+    processStatusFlags(partitionIndex, dscArmedFlags | dscNoEntryDelayFlag, 0);
     processAlarmStatus(partitionIndex, false);
     processEntryDelayStatus(partitionIndex, false);
 
@@ -756,26 +842,9 @@ void dscKeybusInterface::processPanelStatus2(byte partition, byte panelByte) {
 
   // Armed: stay and Armed: away
   if (panelData[panelByte] == 0x9A || panelData[panelByte] == 0x9B) {
-    if (panelData[panelByte] == 0x9A) {
-      armedStay[partitionIndex] = true;
-      armedAway[partitionIndex] = false;
-    }
-    else if (panelData[panelByte] == 0x9B) {
-      armedStay[partitionIndex] = false;
-      armedAway[partitionIndex] = true;
-    }
-
-    armed[partitionIndex] = true;
-    if (armed[partitionIndex] != previousArmed[partitionIndex] || armedStay[partitionIndex] != previousArmedStay[partitionIndex]) {
-      previousArmed[partitionIndex] = armed[partitionIndex];
-      previousArmedStay[partitionIndex] = armedStay[partitionIndex];
-      armedChanged[partitionIndex] = true;
-      if (!pauseStatus) statusChanged = true;
-    }
-
-    processExitDelayStatus(partitionIndex, false);
+    byte armedMode = panelData[panelByte] == 0x9A ? dscArmedStayFlag : dscArmedAwayFlag;
+    processStatusFlags(partitionIndex, dscArmedFlags | dscExitDelayFlag | dscReadyFlag, dscArmedFlag | armedMode);
     exitState[partitionIndex] = 0;
-    processReadyStatus(partitionIndex, false);
     return;
   }
 
@@ -784,10 +853,13 @@ void dscKeybusInterface::processPanelStatus2(byte partition, byte panelByte) {
 
       // Activate stay/away zones
       case 0x99: {
-        armed[partitionIndex] = true;
-        armedAway[partitionIndex] = true;
-        armedStay[partitionIndex] = false;
+        byte changedFlags = processStatusFlags(partitionIndex, dscArmedFlags, dscArmedFlag | dscArmedAwayFlag);
+
+        // Armed is reported as changed even if already set, the event is only queued here if it was not queued above
         armedChanged[partitionIndex] = true;
+        if (!(changedFlags & (dscArmedFlag | dscArmedStayFlag))) {
+          pushStatusEvent(dscEventArmed, partitionIndex, armed[partitionIndex]);
+        }
         if (!pauseStatus) statusChanged = true;
         return;
       }
@@ -861,53 +933,63 @@ void dscKeybusInterface::processPanelStatus5(byte partition, byte panelByte) {
 }
 
 
-void dscKeybusInterface::processReadyStatus(byte partitionIndex, bool status) {
-  ready[partitionIndex] = status;
-  if (ready[partitionIndex] != previousReady[partitionIndex]) {
-    previousReady[partitionIndex] = ready[partitionIndex];
-    readyChanged[partitionIndex] = true;
-    if (!pauseStatus) statusChanged = true;
+// Updates the status flags in flagMask to flagValues, setting the changed flags for each status that changes, and
+// returns the status flags that changed
+byte dscKeybusInterface::processStatusFlags(byte partitionIndex, byte flagMask, byte flagValues) {
+  dscPartitionState &state = partitionState[partitionIndex];
+  byte flags = (state.flags & ~flagMask) | flagValues;
+  byte changedFlags = flags ^ state.flags;
+  if (!changedFlags) return 0;
+  state.flags = flags;
+
+  if (changedFlags & dscReadyFlag) {
+    state.changed |= dscReadyChanged;
+    pushStatusEvent(dscEventReady, partitionIndex, flags & dscReadyFlag);
+  }
+  if (changedFlags & (dscArmedFlag | dscArmedStayFlag | dscNoEntryDelayFlag)) {
+    state.changed |= dscArmedChanged;
+    pushStatusEvent(dscEventArmed, partitionIndex, (flags & dscArmedFlag) != 0);
+  }
+  if (changedFlags & dscExitDelayFlag) {
+    state.changed |= dscExitDelayChanged;
+    pushStatusEvent(dscEventExitDelay, partitionIndex, (flags & dscExitDelayFlag) != 0);
+  }
+  if (changedFlags & dscEntryDelayFlag) {
+    state.changed |= dscEntryDelayChanged;
+    pushStatusEvent(dscEventEntryDelay, partitionIndex, (flags & dscEntryDelayFlag) != 0);
   }
+  if (changedFlags & dscAlarmFlag) {
+    state.changed |= dscAlarmChanged;
+    pushStatusEvent(dscEventAlarm, partitionIndex, (flags & dscAlarmFlag) != 0);
+  }
+
+  if (!pauseStatus && (changedFlags & ~dscArmedAwayFlag)) statusChanged = true;
+  return changedFlags;
+}
+
+
+void dscKeybusInterface::processReadyStatus(byte partitionIndex, bool status) {
+  processStatusFlags(partitionIndex, dscReadyFlag, status ? dscReadyFlag : 0);
 }
 
 
 void dscKeybusInterface::processAlarmStatus(byte partitionIndex, bool status) {
-  alarm[partitionIndex] = status;
-  if (alarm[partitionIndex] != previousAlarm[partitionIndex]) {
-    previousAlarm[partitionIndex] = alarm[partitionIndex];
-    alarmChanged[partitionIndex] = true;
-    if (!pauseStatus) statusChanged = true;
-  }
+  processStatusFlags(partitionIndex, dscAlarmFlag, status ? dscAlarmFlag : 0);
 }
 
 
 void dscKeybusInterface::processExitDelayStatus(byte partitionIndex, bool status) {
-  exitDelay[partitionIndex] = status;
-  if (exitDelay[partitionIndex] != previousExitDelay[partitionIndex]) {
-    previousExitDelay[partitionIndex] = exitDelay[partitionIndex];
-    exitDelayChanged[partitionIndex] = true;
-    if (!pauseStatus) statusChanged = true;
-  }
+  processStatusFlags(partitionIndex, dscExitDelayFlag, status ? dscExitDelayFlag : 0);
 }
 
 
 void dscKeybusInterface::processEntryDelayStatus(byte partitionIndex, bool status) {
-  entryDelay[partitionIndex] = status;
-  if (entryDelay[partitionIndex] != previousEntryDelay[partitionIndex]) {
-    previousEntryDelay[partitionIndex] = entryDelay[partitionIndex];
-    entryDelayChanged[partitionIndex] = true;
-    if (!pauseStatus) statusChanged = true;
-  }
+  processStatusFlags(partitionIndex, dscEntryDelayFlag, status ? dscEntryDelayFlag : 0);
 }
 
 
 void dscKeybusInterface::processNoEntryDelayStatus(byte partitionIndex, bool status) {
-  noEntryDelay[partitionIndex] = status;
-  if (noEntryDelay[partitionIndex] != previousNoEntryDelay[partitionIndex]) {
-    previousNoEntryDelay[partitionIndex] = noEntryDelay[partitionIndex];
-    armedChanged[partitionIndex] = true;
-    if (!pauseStatus) statusChanged = true;
-  }
+  processStatusFlags(partitionIndex, dscNoEntryDelayFlag, status ? dscNoEntryDelayFlag : 0);
 }
 
 
@@ -919,16 +1001,66 @@ void dscKeybusInterface::processZoneStatus(byte zonesByte, byte panelByte) {
     openZonesStatusChanged = true;
     if (!pauseStatus) statusChanged = true;
 
-    for (byte zoneBit = 0; zoneBit < 8; zoneBit++) {
-      if (bitRead(zonesChanged, zoneBit)) {
-        bitWrite(openZonesChanged[zonesByte], zoneBit, 1);
-        if (bitRead(panelData[panelByte], zoneBit)) bitWrite(openZones[zonesByte], zoneBit, 1);
-        else bitWrite(openZones[zonesByte], zoneBit, 0);
-      }
-    }
+    openZonesChanged[zonesByte] |= zonesChanged;
+    pushStatusEvents(dscEventZone, (zonesByte * 8) + 1, zonesChanged, openZones[zonesByte]);
   }
 }
 
+
+// Counts the trailing zero bits of a nonzero byte - AVR does not have an instruction for this, so it is found in 3
+// steps instead of calling the libgcc __builtin_ctz()
+#if defined(__AVR__)
+static byte dscTrailingZeros(byte value) {
+  byte zeros = 0;
+  if (!(value & 0x0F)) {
+    value >>= 4;
+    zeros = 4;
+  }
+  if (!(value & 0x03)) {
+    value >>= 2;
+    zeros += 2;
+  }
+  if (!(value & 0x01)) zeros++;
+  return zeros;
+}
+#else
+#define dscTrailingZeros(value) __builtin_ctz(value)
+#endif
+
+
+// Finds and clears the next changed flag at or after fromBit (1-based) in groups of 8 flags, skipping groups without
+// changes, returns 0 if no flags are set
+byte dscKeybusInterface::nextChangedBit(byte changedFlags[], byte flagGroups, byte fromBit) {
+  if (fromBit == 0) fromBit = 1;
+  byte flagGroup = (fromBit - 1) >> 3;
+  if (flagGroup >= flagGroups) return 0;
+
+  byte pendingFlags = changedFlags[flagGroup] & (0xFF << ((fromBit - 1) & 0x07));
+  while (!pendingFlags) {
+    if (++flagGroup >= flagGroups) return 0;
+    pendingFlags = changedFlags[flagGroup];
+  }
+
+  byte flagBit = dscTrailingZeros(pendingFlags);
+  changedFlags[flagGroup] &= ~(1 << flagBit);
+  return (flagGroup * 8) + flagBit + 1;
+}
+
+
+byte dscKeybusInterface::nextChangedZone(byte fromZone) {
+  return nextChangedBit(openZonesChanged, dscZones, fromZone);
+}
+
+
+byte dscKeybusInterface::nextChangedAlarmZone(byte fromZone) {
+  return nextChangedBit(alarmZonesChanged, dscZones, fromZone);
+}
+
+
+byte dscKeybusInterface::nextChangedPgmOutput(byte fromPgm) {
+  return nextChangedBit(pgmOutputsChanged, 2, fromPgm);
+}
+
 void dscKeybusInterface::processTime(byte panelByte) {
   byte dscYear3 = panelData[panelByte] >> 4;
   byte dscYear4 = panelData[panelByte] & 0x0F;
@@ -944,35 +1076,27 @@ void dscKeybusInterface::processTime(byte panelByte) {
 }
 
 
+// Sets the alarm status of the zone in panelData[panelByte], where zoneCountOffset is the status byte of the first zone
+// in the range and startByte is the alarmZones[] byte of the first zone: 0 for zones 1-32, 4 for zones 33-64
 void dscKeybusInterface::processAlarmZones(byte panelByte, byte startByte, byte zoneCountOffset, byte writeValue) {
-  byte maxZones = dscZones * 8;
-  if (maxZones > 32) {
-    if (startByte < 4) maxZones = 32;
-    else maxZones -= 32;
-  }
-  else if (startByte >= 4) return;
-
-  for (byte zoneCount = 0; zoneCount < maxZones; zoneCount++) {
-    if (panelData[panelByte] == zoneCount + zoneCountOffset) {
-      for (byte zoneRange = 0; zoneRange <= 3; zoneRange++) {
-        if (zoneCount >= (zoneRange * 8) && zoneCount < ((zoneRange * 8) + 8)) {
-          processAlarmZonesStatus(startByte + zoneRange, zoneCount, writeValue);
-        }
-      }
-    }
-  }
+  byte zoneIndex = (byte)(panelData[panelByte] - zoneCountOffset) + (startByte * 8);
+  processAlarmZonesStatus(zoneIndex, writeValue);
 }
 
 
-void dscKeybusInterface::processAlarmZonesStatus(byte zonesByte, byte zoneCount, byte writeValue) {
-  byte zonesRange = zonesByte;
-  if (zonesRange >= 4) zonesRange -= 4;
+void dscKeybusInterface::processAlarmZonesStatus(byte zoneIndex, byte writeValue) {
+  if (zoneIndex >= dscZones * 8) return;
+
+  byte zonesByte = zoneIndex >> 3;
+  byte zoneMask = 1 << (zoneIndex & 0x07);
 
-  bitWrite(alarmZones[zonesByte], (zoneCount - (zonesRange * 8)), writeValue);
+  if (writeValue) alarmZones[zonesByte] |= zoneMask;
+  else alarmZones[zonesByte] &= ~zoneMask;
 
-  if (bitRead(previousAlarmZones[zonesByte], (zoneCount - (zonesRange * 8))) != writeValue) {
-    bitWrite(previousAlarmZones[zonesByte], (zoneCount - (zonesRange * 8)), writeValue);
-    bitWrite(alarmZonesChanged[zonesByte], (zoneCount - (zonesRange * 8)), 1);
+  if ((previousAlarmZones[zonesByte] ^ alarmZones[zonesByte]) & zoneMask) {
+    previousAlarmZones[zonesByte] ^= zoneMask;
+    alarmZonesChanged[zonesByte] |= zoneMask;
+    pushStatusEvent(dscEventAlarmZone, zoneIndex + 1, writeValue);
 
     alarmZonesStatusChanged = true;
     if (!pauseStatus) statusChanged = true;
@@ -981,15 +1105,7 @@ void dscKeybusInterface::processAlarmZonesStatus(byte zonesByte, byte zoneCount,
 
 
 void dscKeybusInterface::processArmed(byte partitionIndex, bool armedStatus) {
-  armedStay[partitionIndex] = armedStatus;
-  armedAway[partitionIndex] = armedStatus;
-  armed[partitionIndex] = armedStatus;
-
-  if (armed[partitionIndex] != previousArmed[partitionIndex]) {
-    previousArmed[partitionIndex] = armed[partitionIndex];
-    armedChanged[partitionIndex] = true;
-    if (!pauseStatus) statusChanged = true;
-  }
+  processStatusFlags(partitionIndex, dscArmedFlags, armedStatus ? dscArmedFlags : 0);
 }
 
 
@@ -1001,10 +1117,186 @@ void dscKeybusInterface::processPanelAccessCode(byte partitionIndex, byte dscCod
     if (dscCode >= 40) dscCode += 3;
   }
 
-  accessCode[partitionIndex] = dscCode;
-  if (accessCode[partitionIndex] != previousAccessCode[partitionIndex]) {
-    previousAccessCode[partitionIndex] = accessCode[partitionIndex];
+  if (dscCode != accessCode[partitionIndex]) {
+    accessCode[partitionIndex] = dscCode;
     accessCodeChanged[partitionIndex] = true;
+    pushStatusEvent(dscEventAccessCode, partitionIndex, accessCode[partitionIndex]);
     if (!pauseStatus) statusChanged = true;
   }
 }
+
+
+// Calls the handler for the status event type if registered, otherwise queues the event or drops all queued events
+// with the buffer full to be read as dscEventResync
+void dscKeybusInterface::pushStatusEvent(byte type, byte index, byte value) {
+  dscStatusHandler handler = statusHandlers[type];
+  if (handler != NULL) {
+    handler(index, value);
+    return;
+  }
+
+  if (statusEventsDropped) return;  // The sketch reads the current status with dscEventResync
+  if (statusEventCount == dscStatusEventBufferSize) {
+    statusEventCount = 0;
+    statusEventsDropped = true;
+    return;
+  }
+
+  byte eventIndex = statusEventHead + statusEventCount;
+  if (eventIndex >= dscStatusEventBufferSize) eventIndex -= dscStatusEventBufferSize;
+  statusEvents[eventIndex].type = type;
+  statusEvents[eventIndex].index = index;
+  statusEvents[eventIndex].value = value;
+  statusEventCount++;
+}
+
+
+// Queues an event for each set bit in changedBits, numbered from firstNumber for bit 0 with the value of the bit
+void dscKeybusInterface::pushStatusEvents(byte type, byte firstNumber, byte changedBits, byte values) {
+  while (changedBits) {
+    byte changedBit = dscTrailingZeros(changedBits);
+    changedBits &= changedBits - 1;
+    pushStatusEvent(type, firstNumber + changedBit, (values >> changedBit) & 0x01);
+  }
+}
+
+
+bool dscKeybusInterface::peekStatusEvent(dscStatusEvent &event) {
+  if (statusEventsDropped) {
+    event.type = dscEventResync;
+    event.index = 0;
+    event.value = 0;
+    return true;
+  }
+  if (statusEventCount == 0) return false;
+
+  event = statusEvents[statusEventHead];
+  return true;
+}
+
+
+bool dscKeybusInterface::nextStatusEvent(dscStatusEvent &event) {
+  if (!peekStatusEvent(event)) return false;
+
+  if (statusEventsDropped) statusEventsDropped = false;
+  else {
+    if (++statusEventHead == dscStatusEventBufferSize) statusEventHead = 0;
+    statusEventCount--;
+  }
+  return true;
+}
+
+
+// Copies the current status to the snapshot buffer that is not being read and swaps the buffers if the status changed
+// since the last snapshot
+void dscKeybusInterface::updateStatusSnapshot() {
+  const dscStatusSnapshot &snapshot = snapshots[snapshotIndex];
+  dscStatusSnapshot &nextSnapshot = snapshots[snapshotIndex ^ 1];
+
+  byte system = 0;
+  if (keybusConnected) system |= dscSnapshotKeybus;
+  if (trouble) system |= dscSnapshotTrouble;
+  if (powerTrouble) system |= dscSnapshotPower;
+  if (batteryTrouble) system |= dscSnapshotBattery;
+  if (keypadFireAlarm) system |= dscSnapshotKeypadFireAlarm;
+  if (keypadAuxAlarm) system |= dscSnapshotKeypadAuxAlarm;
+  if (keypadPanicAlarm) system |= dscSnapshotKeypadPanicAlarm;
+  nextSnapshot.system = system;
+
+  for (byte partitionIndex = 0; partitionIndex < dscPartitions; partitionIndex++) {
+    nextSnapshot.partitions[partitionIndex] = partitionState[partitionIndex];
+    nextSnapshot.partitions[partitionIndex].changed = 0;
+    nextSnapshot.partitions[partitionIndex].other &= dscFireFlag | dscDisabledFlag;
+  }
+  for (byte zoneGroup = 0; zoneGroup < dscZones; zoneGroup++) {
+    nextSnapshot.openZones[zoneGroup] = openZones[zoneGroup];
+    nextSnapshot.alarmZones[zoneGroup] = alarmZones[zoneGroup];
+  }
+  nextSnapshot.pgmOutputs[0] = pgmOutputs[0];
+  nextSnapshot.pgmOutputs[1] = pgmOutputs[1];
+
+  // Compares only the status bytes - the sequence can follow a padding byte that is never written
+  const size_t statusSize = offsetof(dscStatusSnapshot, pgmOutputs) + sizeof(nextSnapshot.pgmOutputs);
+  if (memcmp(&nextSnapshot, &snapshot, statusSize) == 0) return;
+
+  nextSnapshot.sequence = snapshot.sequence + 1;
+  nextSnapshot.time = panelTime;
+  snapshotIndex ^= 1;
+}
+
+
+// Logs a panel event with the panel time set by processTime()
+void dscKeybusInterface::logPanelEvent(byte partition, byte eventClass, byte argument) {
+  dscPanelEvent event;
+  event.year = year - 1900;
+  event.month = month;
+  event.day = day;
+  event.hour = hour;
+  event.minute = minute;
+  event.partition = partition;
+  event.eventClass = eventClass;
+  event.argument = argument;
+
+  // Skips an event sent by both 0xA5 and 0xEB, compared with the newest event which remains in the buffer after it
+  // is read.  panelEventCmd is then cleared so that the event is logged again if the panel repeats it.
+  byte newestIndex = (panelEventHead + panelEventCount + dscPanelEventBufferSize - 1) % dscPanelEventBufferSize;
+  if (panelEventCmd != 0 && panelEventCmd != panelData[0] && memcmp(&panelEvents[newestIndex], &event, sizeof(event)) == 0) {
+    panelEventCmd = 0;
+    return;
+  }
+  panelEventCmd = panelData[0];
+
+  // Overwrites the oldest event with the buffer full
+  if (panelEventCount == dscPanelEventBufferSize) {
+    if (++panelEventHead == dscPanelEventBufferSize) panelEventHead = 0;
+    panelEventCount--;
+    panelEventOverflow = true;
+  }
+
+  byte eventIndex = panelEventHead + panelEventCount;
+  if (eventIndex >= dscPanelEventBufferSize) eventIndex -= dscPanelEventBufferSize;
+  panelEvents[eventIndex] = event;
+  panelEventCount++;
+}
+
+
+bool dscKeybusInterface::peekPanelEvent(dscPanelEvent &event) {
+  if (panelEventCount == 0) return false;
+
+  event = panelEvents[panelEventHead];
+  return true;
+}
+
+
+bool dscKeybusInterface::nextPanelEvent(dscPanelEvent &event) {
+  if (!peekPanelEvent(event)) return false;
+
+  if (++panelEventHead == dscPanelEventBufferSize) panelEventHead = 0;
+  panelEventCount--;
+  return true;
+}
+
+
+void dscKeybusInterface::onStatusChange(byte eventType, dscStatusHandler handler) {
+  if (eventType < dscEventTypes) statusHandlers[eventType] = handler;
+}
+
+
+void dscKeybusInterface::onArmedChange(dscStatusHandler handler) {
+  onStatusChange(dscEventArmed, handler);
+}
+
+
+void dscKeybusInterface::onZoneChange(dscStatusHandler handler) {
+  onStatusChange(dscEventZone, handler);
+}
+
+
+void dscKeybusInterface::onTrouble(dscStatusHandler handler) {
+  onStatusChange(dscEventTrouble, handler);
+}
+
+
+void dscKeybusInterface::onPgmChange(dscStatusHandler handler) {
+  onStatusChange(dscEventPgmOutput, handler);
+}
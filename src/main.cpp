@@ -157,6 +157,11 @@ entity: alarm_control_panel.security_partition_1
  *    Open: "1"
  *    Closed: "0"
  *
+ *  Panel events (arming/disarming by access code, zone alarms, troubles, etc) are published as they are logged by the
+ *  panel in the configured mqttEventTopic with the panel time, partition (0 for system events), and the event class
+ *  and argument in hex, as decoded by printPanelStatus0() ... printPanelStatus1B() in the library:
+ *    Partition 1 in alarm: "2018-03-30 10:17 1 00 4B"
+ *
  *  Release notes
  *    1.4 - Added PGM outputs 1-14 status
  *    1.2 - Added night arm (arming with no entry delay)
@@ -220,6 +225,8 @@ IPAddress const MQTTBrokerIP        (192, 168, 1, 254);
 #define MQTTPGMTopic                MQTTTopicPrefix MQTTTopicGet "/pgm"        // Sends pgm status per zone: alarmsys/get/pgm1 ... alarmsys/get/pgm64
 #define MQTTFireTopic               MQTTTopicPrefix MQTTTopicGet "/fire"       // Sends fire status per partition: alarmsys/get/Fire1 ... alarmsys/get/Fire8
 #define MQTTTroubleTopic            MQTTTopicPrefix MQTTTopicGet "/trouble"    // Sends trouble status
+#define MQTTEventTopic              MQTTTopicPrefix MQTTTopicGet "/event"      // Sends panel events
+#define MQTTCommandTopic            MQTTTopicPrefix MQTTTopicGet "/command"    // Acknowledges commands received in MQTTSubscribeTopic
 #define MQTTSubscribeTopic          MQTTTopicPrefix MQTTTopicSet               // Receives messages to write to the panel
 #define MQTTPubAvailable            MQTTTopicPrefix MQTTTopicGet "/available"
 #define MQTTPubParitionNumberlen    (2 * sizeof(char))
@@ -240,6 +247,10 @@ IPAddress const MQTTBrokerIP        (192, 168, 1, 254);
 #define MQTTPubPayloadFireIdle      "0"
 #define MQTTPubPayloadTroubleActive "1"
 #define MQTTPubPayloadTroubleIdle   "0"
+#define MQTTPubPayloadCommandWritten "written"
+#define MQTTPubPayloadCommandTimeout "timeout"
+#define MQTTPubPayloadCommandSkipped "skipped"
+#define MQTTPubPayloadCommandFull   "full"
 #define MQTTWillQos                 (0)
 #define MQTTWillRetain              (1)
 #define MQTTAvailablePayload        "online"
@@ -247,12 +258,13 @@ IPAddress const MQTTBrokerIP        (192, 168, 1, 254);
 #define MQTTNotRetain               (false)
 #define MQTTRetain                  (true)
 #define ConnectBrokerRetryInterval_ms (2000)
+#define LatencyReportInterval_ms    (60000)
 
 // Configures the Keybus interface with the specified pins - dscWritePin is optional, leaving it out disables the
-// virtual keypad.
-#define dscClockPin (2)  // Arduino Uno hardware interrupt pin: 2,3
-#define dscReadPin  (3)  // Arduino Uno: 2-12
-#define dscWritePin (4)  // Arduino Uno: 2-12
+// virtual keypad.  The pins are set in platformio.ini build flags so the library interrupts use direct port access.
+#define dscClockPin (DSC_CLOCK_PIN)  // Arduino Uno hardware interrupt pin: 2,3
+#define dscReadPin  (DSC_READ_PIN)   // Arduino Uno: 2-12
+#define dscWritePin (DSC_WRITE_PIN)  // Arduino Uno: 2-12
 #define accessCode  SecretDscAccessCode   // An access code is required to disarm/night arm and may be required to arm based on panel configuration. Define string in secret.h
 #define DefaultPartitionId (1)
 
@@ -275,11 +287,35 @@ boolean mqttHandle (void);
 static bool publishMQTTMessage (char const * const sMQTTSubscription, char const * const sMQTTData, bool retain);
 static void advanceTimers (void);
 static void appendPartition(const char* sourceTopic, byte sourceNumber, char* publishTopic);
-static void initialPublish (void);
+static bool publishStatusEvent (dscStatusEvent const & event);
+static void publishHandledEvent (byte type, byte index, byte value);
+static void keybusHandler (byte index, byte connected);
+static void troubleHandler (byte index, byte trouble);
+static void armedHandler (byte partition, byte armed);
+static void exitDelayHandler (byte partition, byte exitDelay);
+static void alarmHandler (byte partition, byte alarm);
+static void fireHandler (byte partition, byte fire);
+static void zoneHandler (byte zone, byte open);
+static void pgmHandler (byte pgm, byte enabled);
+static bool publishKeybusStatus (void);
+static bool publishAllStatus (void);
+static bool publishPartitionArmed (byte partition, byte partitionFlags);
+static bool publishPartitionFire (byte partition, bool fire);
+static bool publishNumbered (const char* sourceTopic, byte number, bool active);
+static bool publishPanelEvent (dscPanelEvent const & event);
+static void writePartitionKeys (byte partition, char suffix, char const * keys);
+static bool publishCommandAck (void);
+#if defined(DSC_LATENCY_STATS)
+static void printLatencyStats (void);
+#endif
 
 // Static variables
 static uint32_t mqttActionTimer;
 static unsigned long previous;
+static bool publishAllPending;  // Set after connecting to the MQTT broker to publish the full status
+static bool commandAckPending;  // Set after writing a command received in MQTTSubscribeTopic until it is acknowledged
+static byte commandHandle;      // Write handle of the last command, 0 if the write buffer was full
+static char commandName[] = "1A";  // Partition number and payload suffix of the last command
 
 void setup (void) 
 {
@@ -296,6 +332,16 @@ void setup (void)
 
   mqtt.setCallback(mqttCallback);
 
+  // Publishes status changes as the Keybus commands are decoded by dsc.loop()
+  dsc.onStatusChange(dscEventKeybus, keybusHandler);
+  dsc.onTrouble(troubleHandler);
+  dsc.onArmedChange(armedHandler);
+  dsc.onStatusChange(dscEventExitDelay, exitDelayHandler);
+  dsc.onStatusChange(dscEventAlarm, alarmHandler);
+  dsc.onStatusChange(dscEventFire, fireHandler);
+  dsc.onZoneChange(zoneHandler);
+  dsc.onPgmChange(pgmHandler);
+
   // Starts the Keybus interface and optionally specifies how to print data.
   // begin() sets Serial by default and can accept a different stream: begin(Serial1), etc.
   dsc.begin();
@@ -320,296 +366,69 @@ void loop (void)
       // handlePanel() more often, or increase dscBufferSize in the library: src/dscKeybusInterface.h
       if(dsc.bufferOverflow) 
       {
-        Serial.println(F("Keybus buffer overflow"));
+        Serial.print(F("Keybus buffer overflow, high water: "));
+        Serial.println(dsc.bufferHighWater);
         dsc.bufferOverflow = false;
       }
 
-      // Checks if the interface is connected to the Keybus
-      if (dsc.keybusChanged) 
-      {
-        bool messageSent = false;
-
-        if (dsc.keybusConnected) 
-        {
-          messageSent = publishMQTTMessage(MQTTPubAvailable, MQTTAvailablePayload, MQTTRetain);
-
-          initialPublish();
-        }
-        else 
-        {
-          messageSent = publishMQTTMessage(MQTTPubAvailable, MQTTUnavailablePayload, MQTTRetain);  
-        }
-
-        if(messageSent)
-        {
-          dsc.keybusChanged = false;  // Resets the Keybus data status flag
-        }
-      }
+    }
 
-      // Sends the access code when needed by the panel for arming
-      if(dsc.accessCodePrompt) 
-      {
-        dsc.accessCodePrompt = false;
-        dsc.write(accessCode);
-      }
+    // Sends the access code when needed by the panel for arming, retried on the next loop if the write buffer is full
+    if(dsc.accessCodePrompt && dsc.write(accessCode)) 
+    {
+      dsc.accessCodePrompt = false;
+    }
 
-      if(dsc.troubleChanged) 
-      {
-        bool messageSent = false;
-
-        if(dsc.trouble) 
-        {
-          messageSent = publishMQTTMessage(MQTTTroubleTopic, MQTTPubPayloadTroubleActive, MQTTRetain);
-        }
-        else 
-        {
-          messageSent = publishMQTTMessage(MQTTTroubleTopic, MQTTPubPayloadTroubleIdle, MQTTRetain);
-        }
-        
-        if(messageSent)
-        {
-          dsc.troubleChanged = false;  // Resets the trouble status flag
-        }
-      }
-      // Publishes status per partition
-      for(byte partition = 0; partition < dscPartitions; partition++) 
-      {
+    // Publishes the availability and full status after connecting to the MQTT broker
+    if(publishAllPending)
+    {
+      publishAllPending = (false == publishKeybusStatus());
+    }
 
-        // Skips processing if the partition is disabled or in installer programming
-        if (dsc.disabled[partition]) 
-        {
-          continue;
-        }
-
-        // Publishes armed/disarmed status
-        if(dsc.armedChanged[partition]) 
-        {
-          // Appends the mqttPartitionTopic with the partition number
-          char publishTopic[strlen(MQTTPartitionTopic) + MQTTPubParitionNumberlen];
-          appendPartition(MQTTPartitionTopic, partition, publishTopic);  // Appends the mqttPartitionTopic with the partition number
-
-          bool messageSent = false;
-
-          if(dsc.armed[partition]) 
-          {
-            if (dsc.armedAway[partition] && dsc.noEntryDelay[partition])
-            {
-              messageSent = publishMQTTMessage(publishTopic, MQTTPubPayloadArmNight, MQTTRetain);
-            }
-            else if (dsc.armedAway[partition])
-            {
-              messageSent = publishMQTTMessage(publishTopic, MQTTPubPayloadArm, MQTTRetain);
-            }
-            else if(dsc.armedStay[partition] && dsc.noEntryDelay[partition]) 
-            {
-              messageSent = publishMQTTMessage(publishTopic, MQTTPubPayloadArmNight, MQTTRetain);
-            }
-            else if(dsc.armedStay[partition])
-            {
-              messageSent = publishMQTTMessage(publishTopic, MQTTPubPayloadArmStay, MQTTRetain);
-            }
-            else
-            {
-              messageSent = true;
-            }
-          }
-          else
-          {
-            messageSent = publishMQTTMessage(publishTopic, MQTTPubPayloadDisarm, MQTTRetain);
-          }
-
-          if(messageSent)
-          {
-            dsc.armedChanged[partition] = false;  // Resets the partition armed status flag
-          }
-        }
-
-        // Publishes exit delay status
-        if(dsc.exitDelayChanged[partition]) 
-        {
-          // Appends the mqttPartitionTopic with the partition number
-          char publishTopic[strlen(MQTTPartitionTopic) + MQTTPubParitionNumberlen + NULLTERM_LEN];
-          appendPartition(MQTTPartitionTopic, partition, publishTopic);  // Appends the mqttPartitionTopic with the partition number
-
-          bool messageSent = false;
-        
-          if(dsc.exitDelay[partition]) 
-          {
-            messageSent = publishMQTTMessage(publishTopic, MQTTPubPayloadPending, MQTTRetain);  // Publish as a retained message
-          }
-          else if((false == dsc.exitDelay[partition]) && (false == dsc.armed[partition])) 
-          {
-            messageSent = publishMQTTMessage(publishTopic, MQTTPubPayloadDisarm, MQTTRetain);
-          }
-          else
-          {
-            messageSent = true;
-          }
-
-          if(messageSent)
-          {
-            dsc.exitDelayChanged[partition] = false;  // Resets the exit delay status flag
-          }
-        }
-
-        // Publishes alarm status
-        if(dsc.alarmChanged[partition]) 
-        {
-          // Appends the mqttPartitionTopic with the partition number
-          char publishTopic[strlen(MQTTPartitionTopic) + MQTTPubParitionNumberlen + NULLTERM_LEN];
-          appendPartition(MQTTPartitionTopic, partition, publishTopic);  // Appends the mqttPartitionTopic with the partition number
-
-          bool messageSent = false;
-          
-          if(dsc.alarm[partition]) 
-          {
-            messageSent = publishMQTTMessage(publishTopic, MQTTPubPayloadAlarmTrigger, MQTTRetain);  // Alarm tripped
-          }
-          else if(false == dsc.armedChanged[partition])
-          {
-            messageSent = publishMQTTMessage(publishTopic, MQTTPubPayloadDisarm, MQTTRetain);
-          }
-          else
-          {
-            messageSent = true;
-          }
-
-          if(messageSent)
-          {
-            dsc.alarmChanged[partition] = false;  // Resets the partition alarm status flag
-          }
-        }
-
-        if (dsc.armedChanged[partition]) 
-        {
-          dsc.armedChanged[partition] = false;  // Resets the partition armed status flag
-        }
-
-        // Publishes fire alarm status
-        if(dsc.fireChanged[partition]) 
-        {
-          // Appends the mqttFireTopic with the partition number
-          char firePublishTopic[strlen(MQTTFireTopic) + MQTTPubParitionNumberlen + NULLTERM_LEN];
-          appendPartition(MQTTFireTopic, partition, firePublishTopic);  // Appends the mqttFireTopic with the partition number
-
-          bool messageSent = false;
-
-          if(dsc.fire[partition]) 
-          {
-            messageSent = publishMQTTMessage(firePublishTopic, MQTTPubPayloadFireTrigger, MQTTNotRetain);  // Fire alarm tripped
-          }
-          else 
-          {
-            messageSent = publishMQTTMessage(firePublishTopic, MQTTPubPayloadFireIdle, MQTTNotRetain);  // Fire alarm restored
-          }
-
-          if(messageSent)
-          {
-            dsc.fireChanged[partition] = false;  // Resets the fire status flag
-          }
-        }
-      }
+    // Publishes the remaining queued status events, the published status is handled in dsc.loop() by the handlers
+    // registered in setup().  An event stays queued if its message could not be sent and is retried on the next loop.
+    dscStatusEvent event;
 
-      // Publishes zones 1-64 status in a separate topic per zone
-      // Zone status is stored in the openZones[] and openZonesChanged[] arrays using 1 bit per zone, up to 64 zones:
-      //   openZones[0] and openZonesChanged[0]: Bit 0 = Zone 1 ... Bit 7 = Zone 8
-      //   openZones[1] and openZonesChanged[1]: Bit 0 = Zone 9 ... Bit 7 = Zone 16
-      //   ...
-      //   openZones[7] and openZonesChanged[7]: Bit 0 = Zone 57 ... Bit 7 = Zone 64
-      if(dsc.openZonesStatusChanged) 
+    while(dsc.peekStatusEvent(event))
+    {
+      if(false == publishStatusEvent(event))
       {
-        bool allZoneReported = true;
-        
-        for(byte zoneGroup = 0; zoneGroup < dscZones; zoneGroup++) 
-        {
-          for(byte zoneBit = 0; zoneBit < 8; zoneBit++) 
-          {
-            if(bitRead(dsc.openZonesChanged[zoneGroup], zoneBit))   // Checks an individual open zone status flag
-            {
-              // Appends the mqttZoneTopic with the zone number
-              char zonePublishTopic[strlen(MQTTZoneTopic) + 3];
-              char zone[3];
-              strcpy(zonePublishTopic, MQTTZoneTopic);
-              itoa(zoneBit + 1 + (zoneGroup * 8), zone, 10);
-              strcat(zonePublishTopic, zone);
-
-              bool messageSent = false;
-
-              if(bitRead(dsc.openZones[zoneGroup], zoneBit)) 
-              {
-                messageSent = publishMQTTMessage(zonePublishTopic, MQTTPubPayloadZoneTrigger, MQTTRetain); // Zone open
-              }
-              else 
-              {
-                messageSent = publishMQTTMessage(zonePublishTopic, MQTTPubPayloadZoneIdle, MQTTRetain); // Zone closed
-              }
-
-              allZoneReported &= messageSent;
-
-              if(messageSent)
-              {
-                bitWrite(dsc.openZonesChanged[zoneGroup], zoneBit, 0);  // Resets the individual open zone status flag
-              }
-            }
-          }
-        }
-
-        if(allZoneReported)
-        {
-          dsc.openZonesStatusChanged = false;                           // Resets the open zones status flag
-        }
+        break;
       }
 
-      // Publishes PGM outputs 1-14 status in a separate topic per zone
-      // PGM status is stored in the pgmOutputs[] and pgmOutputsChanged[] arrays using 1 bit per PGM output:
-      //   pgmOutputs[0] and pgmOutputsChanged[0]: Bit 0 = PGM 1 ... Bit 7 = PGM 8
-      //   pgmOutputs[1] and pgmOutputsChanged[1]: Bit 0 = PGM 9 ... Bit 5 = PGM 14
-      if (dsc.pgmOutputsStatusChanged) 
+      dsc.nextStatusEvent(event);  // Removes the published event
+    }
+
+    // Publishes the panel event log, an event stays logged if its message could not be sent
+    if(dsc.panelEventOverflow)
+    {
+      Serial.println(F("Panel event log overflow"));
+      dsc.panelEventOverflow = false;
+    }
+
+    dscPanelEvent panelEvent;
+
+    while(dsc.peekPanelEvent(panelEvent))
+    {
+      if(false == publishPanelEvent(panelEvent))
       {
-        bool allPGMReported = true;
-
-        for (byte pgmGroup = 0; pgmGroup < 2; pgmGroup++) 
-        {
-          for (byte pgmBit = 0; pgmBit < 8; pgmBit++) 
-          {
-            if (bitRead(dsc.pgmOutputsChanged[pgmGroup], pgmBit))   // Checks an individual PGM output status flag
-            {
-              // Appends the mqttPgmTopic with the PGM number
-              char pgmPublishTopic[strlen(MQTTPGMTopic) + 3];
-              char pgm[3];
-              strcpy(pgmPublishTopic, MQTTPGMTopic);
-              itoa(pgmBit + 1 + (pgmGroup * 8), pgm, 10);
-              strcat(pgmPublishTopic, pgm);
-
-              bool messageSent = false;
-
-              if (bitRead(dsc.pgmOutputs[pgmGroup], pgmBit)) 
-              {
-                messageSent = publishMQTTMessage(pgmPublishTopic, MQTTPubPayloadZoneTrigger, MQTTRetain); // PGM enabled
-              }
-              else 
-              {
-                messageSent = publishMQTTMessage(pgmPublishTopic, MQTTPubPayloadZoneIdle, MQTTRetain); // PGM disabled
-              }
-
-              allPGMReported &= messageSent;
-
-              if(messageSent)
-              {
-                bitWrite(dsc.pgmOutputsChanged[pgmGroup], pgmBit, 0);  // Resets the individual PGM output status flag
-              }
-            }
-          }
-        }
-
-        if(allPGMReported)
-        {
-          dsc.pgmOutputsStatusChanged = false;  // Resets the PGM outputs status flag
-        }
+        break;
       }
+
+      dsc.nextPanelEvent(panelEvent);  // Removes the published event
+    }
+
+    // Acknowledges the last command once its keys are written to the Keybus or time out
+    if(commandAckPending)
+    {
+      commandAckPending = (false == publishCommandAck());
     }
   }
 
+#if defined(DSC_LATENCY_STATS)
+  printLatencyStats();
+#endif
+
   advanceTimers();
   Ethernet.maintain();
 }
@@ -634,7 +453,7 @@ void mqttCallback (char* topic, byte* payload, unsigned int length)
   Serial.println(szTemp);
 
 
-  byte partition = DefaultPartitionId;
+  byte partition = DefaultPartitionId - 1;  // Partition index
   byte payloadIndex = 0;
 
   // Checks if a partition number 1-8 has been sent and sets the second character as the payload
@@ -644,53 +463,61 @@ void mqttCallback (char* topic, byte* payload, unsigned int length)
     payloadIndex = 1;
   }
 
+  // Skips partitions above the number of partitions the interface is built for
+  if(partition >= dscPartitions)
+  {
+    return;
+  }
+
   // Panic alarm
   if('P' == payload[payloadIndex]) 
   {
-    dsc.write('p');
+    writePartitionKeys(partition, payload[payloadIndex], "p");
   }
 
+  // Reads the partition status from a single snapshot, so that the status checks below are not mixed from different
+  // Keybus commands
+  byte const partitionFlags = dsc.statusSnapshot()->partitions[partition].flags;
+  bool const ready = partitionFlags & dscReadyFlag;
+  bool const armed = partitionFlags & dscArmedFlag;
+  bool const exitDelay = partitionFlags & dscExitDelayFlag;
+  bool const entryDelay = partitionFlags & dscEntryDelayFlag;
+
   // Resets status if attempting to change the armed mode while armed or not ready
-  if((MQTTSubPayloadDisarmSuffix != payload[payloadIndex]) && (false == dsc.ready[partition])) 
+  if((MQTTSubPayloadDisarmSuffix != payload[payloadIndex]) && (false == ready)) 
   {
-    dsc.armedChanged[partition] = true;
-    dsc.statusChanged = true;
+    publishPartitionArmed(partition, partitionFlags);
     return;
   }
 
   // Arm stay
-  if((MQTTSubPayloadArmStaySuffix == payload[payloadIndex]) && (false == dsc.armed[partition]) && (false == dsc.exitDelay[partition])) 
+  if((MQTTSubPayloadArmStaySuffix == payload[payloadIndex]) && (false == armed) && (false == exitDelay)) 
   {
-    dsc.writePartition = partition + 1;         // Sets writes to the partition number
-    dsc.write('s');                             // Virtual keypad arm stay
+    writePartitionKeys(partition, payload[payloadIndex], "s");          // Virtual keypad arm stay
   }
 
   // Arm away
-  else if((MQTTSubPayloadArmSuffix == payload[payloadIndex]) && (false == dsc.armed[partition]) && (false == dsc.exitDelay[partition])) 
+  else if((MQTTSubPayloadArmSuffix == payload[payloadIndex]) && (false == armed) && (false == exitDelay)) 
   {
-    dsc.writePartition = partition + 1;         // Sets writes to the partition number
-    dsc.write('w');                             // Virtual keypad arm away
+    writePartitionKeys(partition, payload[payloadIndex], "w");          // Virtual keypad arm away
   }
 
   // Disarm
-  else if(MQTTSubPayloadDisarmSuffix == payload[payloadIndex] && (dsc.exitDelay[partition] || dsc.entryDelay[partition] || dsc.armed[partition])) 
+  else if(MQTTSubPayloadDisarmSuffix == payload[payloadIndex] && (exitDelay || entryDelay || armed)) 
   {
-    dsc.writePartition = partition + 1;         // Sets writes to the partition number
-    dsc.write(accessCode);
+    writePartitionKeys(partition, payload[payloadIndex], accessCode);
   }
 
   // Arm night
-  else if((MQTTSubPayloadNightSuffix == payload[payloadIndex]) && (false == dsc.armed[partition]) && (false == dsc.exitDelay[partition]))
+  else if((MQTTSubPayloadNightSuffix == payload[payloadIndex]) && (false == armed) && (false == exitDelay))
   {
-    dsc.writePartition = partition + 1;         // Sets writes to the partition number
-    dsc.write('n');                             // Virtual keypad arm away
+    writePartitionKeys(partition, payload[payloadIndex], "n");          // Virtual keypad arm away
   }
 
   // Silence trouble
-  else if((MQTTSubPayloadSilenceSuffix == payload[payloadIndex]) && (false == dsc.armed[partition]) && (false == dsc.exitDelay[partition])) 
+  else if((MQTTSubPayloadSilenceSuffix == payload[payloadIndex]) && (false == armed) && (false == exitDelay)) 
   {
-    dsc.writePartition = partition + 1;         // Sets writes to the partition number
-    dsc.write('#');
+    writePartitionKeys(partition, payload[payloadIndex], "#");
   }
 }
 
@@ -714,7 +541,7 @@ boolean mqttHandle (void)
         Serial.println(F("MQTT connected."));
         mqtt.subscribe(MQTTSubscribeTopic); 
         mqttActionTimer = 0;
-        dsc.keybusChanged = true;
+        publishAllPending = true;
       }
     }
   }
@@ -760,36 +587,401 @@ static void appendPartition(const char* sourceTopic, byte sourceNumber, char* pu
   strcat(publishTopic, partitionNumber);
 }
 
-static void initialPublish (void)
+// Publishes a status event, returns false if the message could not be sent
+static bool publishStatusEvent (dscStatusEvent const & event)
+{
+  byte const partition = event.index;
+
+  switch(event.type)
+  {
+    // Publishes the current status if status events were dropped
+    case dscEventResync:
+    case dscEventKeybus:
+    {
+      return publishKeybusStatus();
+    }
+
+    case dscEventTrouble:
+    {
+      return publishMQTTMessage(MQTTTroubleTopic, event.value ? MQTTPubPayloadTroubleActive : MQTTPubPayloadTroubleIdle, MQTTRetain);
+    }
+
+    // Publishes armed/disarmed status
+    case dscEventArmed:
+    {
+      // Skips processing if the partition is disabled or in installer programming
+      if(dsc.disabled[partition])
+      {
+        return true;
+      }
+
+      return publishPartitionArmed(partition, dsc.partitionState[partition].flags);
+    }
+
+    // Publishes exit delay status
+    case dscEventExitDelay:
+    {
+      if(dsc.disabled[partition])
+      {
+        return true;
+      }
+
+      // Appends the mqttPartitionTopic with the partition number
+      char publishTopic[strlen(MQTTPartitionTopic) + MQTTPubParitionNumberlen + NULLTERM_LEN];
+      appendPartition(MQTTPartitionTopic, partition, publishTopic);
+
+      if(event.value) 
+      {
+        return publishMQTTMessage(publishTopic, MQTTPubPayloadPending, MQTTRetain);  // Publish as a retained message
+      }
+      else if(false == dsc.armed[partition]) 
+      {
+        return publishMQTTMessage(publishTopic, MQTTPubPayloadDisarm, MQTTRetain);
+      }
+
+      return true;
+    }
+
+    // Publishes alarm status, the armed status is published again when the alarm is restored
+    case dscEventAlarm:
+    {
+      if(dsc.disabled[partition])
+      {
+        return true;
+      }
+
+      if(event.value) 
+      {
+        // Appends the mqttPartitionTopic with the partition number
+        char publishTopic[strlen(MQTTPartitionTopic) + MQTTPubParitionNumberlen + NULLTERM_LEN];
+        appendPartition(MQTTPartitionTopic, partition, publishTopic);
+
+        return publishMQTTMessage(publishTopic, MQTTPubPayloadAlarmTrigger, MQTTRetain);  // Alarm tripped
+      }
+
+      return publishPartitionArmed(partition, dsc.partitionState[partition].flags);
+    }
+
+    // Publishes fire alarm status
+    case dscEventFire:
+    {
+      if(dsc.disabled[partition])
+      {
+        return true;
+      }
+
+      return publishPartitionFire(partition, event.value);
+    }
+
+    // Publishes zones 1-64 status in a separate topic per zone
+    case dscEventZone:
+    {
+      return publishNumbered(MQTTZoneTopic, event.index, event.value);
+    }
+
+    // Publishes PGM outputs 1-14 status in a separate topic per PGM output
+    case dscEventPgmOutput:
+    {
+      return publishNumbered(MQTTPGMTopic, event.index, event.value);
+    }
+  }
+
+  return true;  // Status that is not published
+}
+
+// Publishes a status change from a status handler and records the publish latency, the full status is published on
+// the next loop if the message could not be sent
+static void publishHandledEvent (byte type, byte index, byte value)
+{
+  dscStatusEvent const event = { type, index, value };
+
+  if(false == publishStatusEvent(event))
+  {
+    publishAllPending = true;
+  }
+#if defined(DSC_LATENCY_STATS)
+  else if(dscEventKeybus != type)
+  {
+    dsc.publishLatency.record(millis() - dsc.panelTime);  // Keybus capture to MQTT publish latency of the command being decoded
+  }
+#endif
+}
+
+static void keybusHandler (byte index, byte connected)
+{
+  publishHandledEvent(dscEventKeybus, index, connected);
+}
+
+static void troubleHandler (byte index, byte trouble)
+{
+  publishHandledEvent(dscEventTrouble, index, trouble);
+}
+
+static void armedHandler (byte partition, byte armed)
 {
-  dsc.troubleChanged = true;
+  publishHandledEvent(dscEventArmed, partition, armed);
+}
+
+static void exitDelayHandler (byte partition, byte exitDelay)
+{
+  publishHandledEvent(dscEventExitDelay, partition, exitDelay);
+}
+
+static void alarmHandler (byte partition, byte alarm)
+{
+  publishHandledEvent(dscEventAlarm, partition, alarm);
+}
+
+static void fireHandler (byte partition, byte fire)
+{
+  publishHandledEvent(dscEventFire, partition, fire);
+}
+
+static void zoneHandler (byte zone, byte open)
+{
+  publishHandledEvent(dscEventZone, zone, open);
+}
+
+static void pgmHandler (byte pgm, byte enabled)
+{
+  publishHandledEvent(dscEventPgmOutput, pgm, enabled);
+}
+
+// Publishes the Keybus availability, and the full status if the Keybus is connected
+static bool publishKeybusStatus (void)
+{
+  if(false == dsc.keybusConnected)
+  {
+    return publishMQTTMessage(MQTTPubAvailable, MQTTUnavailablePayload, MQTTRetain);
+  }
+
+  if(false == publishMQTTMessage(MQTTPubAvailable, MQTTAvailablePayload, MQTTRetain))
+  {
+    return false;
+  }
+
+  return publishAllStatus();
+}
+
+// Publishes the current trouble, partition, zone and PGM output status, returns false if any message could not be sent.
+// The status is read from a single snapshot so that the published status is consistent.
+static bool publishAllStatus (void)
+{
+  dscStatusSnapshot const * const snapshot = dsc.statusSnapshot();
+
+  bool allReported = publishMQTTMessage(MQTTTroubleTopic, (snapshot->system & dscSnapshotTrouble) ? MQTTPubPayloadTroubleActive : MQTTPubPayloadTroubleIdle, MQTTRetain);
+
   for(byte partition = 0; partition < dscPartitions; partition++) 
   {
+    dscPartitionState const & partitionStatus = snapshot->partitions[partition];
+
     // Skips processing if the partition is disabled or in installer programming
-    if (dsc.disabled[partition]) 
+    if (partitionStatus.other & dscDisabledFlag) 
     {
       continue;
     }
 
-    dsc.armedChanged[partition] = true;
-    dsc.fireChanged[partition] = true;
+    allReported &= publishPartitionArmed(partition, partitionStatus.flags);
+    allReported &= publishPartitionFire(partition, partitionStatus.other & dscFireFlag);
   }
 
-  dsc.openZonesStatusChanged = true;
-  for(byte zoneGroup = 0; zoneGroup < dscZones; zoneGroup++) 
+  // Zone status is stored in the openZones[] array using 1 bit per zone, up to 64 zones:
+  //   openZones[0]: Bit 0 = Zone 1 ... Bit 7 = Zone 8
+  //   ...
+  //   openZones[7]: Bit 0 = Zone 57 ... Bit 7 = Zone 64
+  for(byte zone = 1; zone <= dscZones * 8; zone++) 
   {
-    for(byte zoneBit = 0; zoneBit < 8; zoneBit++) 
+    allReported &= publishNumbered(MQTTZoneTopic, zone, bitRead(snapshot->openZones[(zone - 1) / 8], (zone - 1) % 8));
+  }
+
+  // PGM status is stored in the pgmOutputs[] array using 1 bit per PGM output:
+  //   pgmOutputs[0]: Bit 0 = PGM 1 ... Bit 7 = PGM 8
+  //   pgmOutputs[1]: Bit 0 = PGM 9 ... Bit 5 = PGM 14
+  for(byte pgm = 1; pgm <= 14; pgm++) 
+  {
+    allReported &= publishNumbered(MQTTPGMTopic, pgm, bitRead(snapshot->pgmOutputs[(pgm - 1) / 8], (pgm - 1) % 8));
+  }
+
+  return allReported;
+}
+
+// Publishes the armed/disarmed status of a partition from its status flags
+static bool publishPartitionArmed (byte partition, byte partitionFlags)
+{
+  // Appends the mqttPartitionTopic with the partition number
+  char publishTopic[strlen(MQTTPartitionTopic) + MQTTPubParitionNumberlen + NULLTERM_LEN];
+  appendPartition(MQTTPartitionTopic, partition, publishTopic);
+
+  if(partitionFlags & dscArmedFlag) 
+  {
+    if ((partitionFlags & dscArmedAwayFlag) && (partitionFlags & dscNoEntryDelayFlag))
+    {
+      return publishMQTTMessage(publishTopic, MQTTPubPayloadArmNight, MQTTRetain);
+    }
+    else if (partitionFlags & dscArmedAwayFlag)
+    {
+      return publishMQTTMessage(publishTopic, MQTTPubPayloadArm, MQTTRetain);
+    }
+    else if((partitionFlags & dscArmedStayFlag) && (partitionFlags & dscNoEntryDelayFlag)) 
     {
-      bitWrite(dsc.openZonesChanged[zoneGroup], zoneBit, 1);
+      return publishMQTTMessage(publishTopic, MQTTPubPayloadArmNight, MQTTRetain);
     }
+    else if(partitionFlags & dscArmedStayFlag)
+    {
+      return publishMQTTMessage(publishTopic, MQTTPubPayloadArmStay, MQTTRetain);
+    }
+
+    return true;
   }
 
-  dsc.pgmOutputsStatusChanged = true;
-  for(byte pgmGroup = 0; pgmGroup < 2; pgmGroup++) 
+  return publishMQTTMessage(publishTopic, MQTTPubPayloadDisarm, MQTTRetain);
+}
+
+// Publishes the fire alarm status of a partition
+static bool publishPartitionFire (byte partition, bool fire)
+{
+  // Appends the mqttFireTopic with the partition number
+  char firePublishTopic[strlen(MQTTFireTopic) + MQTTPubParitionNumberlen + NULLTERM_LEN];
+  appendPartition(MQTTFireTopic, partition, firePublishTopic);
+
+  if(fire) 
   {
-    for(byte pgmBit = 0; pgmBit < 8; pgmBit++) 
+    return publishMQTTMessage(firePublishTopic, MQTTPubPayloadFireTrigger, MQTTNotRetain);  // Fire alarm tripped
+  }
+
+  return publishMQTTMessage(firePublishTopic, MQTTPubPayloadFireIdle, MQTTNotRetain);  // Fire alarm restored
+}
+
+// Publishes a zone or PGM output status in a topic appended with its number
+static bool publishNumbered (const char* sourceTopic, byte number, bool active)
+{
+  char publishTopic[strlen(sourceTopic) + 3];
+  char numberText[3];
+  strcpy(publishTopic, sourceTopic);
+  itoa(number, numberText, 10);
+  strcat(publishTopic, numberText);
+
+  if(active) 
+  {
+    return publishMQTTMessage(publishTopic, MQTTPubPayloadZoneTrigger, MQTTRetain); // Zone open, PGM enabled
+  }
+
+  return publishMQTTMessage(publishTopic, MQTTPubPayloadZoneIdle, MQTTRetain); // Zone closed, PGM disabled
+}
+
+// Writes keys to a partition for the command with the payload suffix, the keys are buffered by the library and
+// written without blocking
+static void writePartitionKeys (byte partition, char suffix, char const * keys)
+{
+  commandName[0] = '1' + partition;
+  commandName[1] = suffix;
+  dsc.writePartition = partition + 1;
+  commandHandle = dsc.write(keys);
+  commandAckPending = true;
+
+  if(0 == commandHandle)
+  {
+    Serial.println(F("Keybus write buffer full"));
+  }
+}
+
+// Publishes the result of the last command and the latency from receiving it to writing it to the Keybus:
+// "1A written 850".  Returns false while the keys are being written or if the message could not be sent.
+static bool publishCommandAck (void)
+{
+  char const * result = MQTTPubPayloadCommandFull;
+  unsigned long latency = 0;
+
+  if(0 != commandHandle)
+  {
+    dscWriteCommand const * const command = dsc.writeCommand(commandHandle);
+    if(NULL == command)
     {
-      bitWrite(dsc.pgmOutputsChanged[pgmGroup], pgmBit, 1);
+      return true;  // Replaced by later writes before it could be acknowledged
     }
+    if((dscWriteQueued == command->status) || (dscWriteInProgress == command->status))
+    {
+      return false;
+    }
+    if(dscWriteWritten == command->status)
+    {
+      result = MQTTPubPayloadCommandWritten;
+    }
+    else if(dscWriteSkipped == command->status)
+    {
+      result = MQTTPubPayloadCommandSkipped;  // The partition is disabled
+    }
+    else
+    {
+      result = MQTTPubPayloadCommandTimeout;
+    }
+    latency = command->endTime - command->queuedTime;
+  }
+
+  char payload[sizeof(commandName) + sizeof(MQTTPubPayloadCommandWritten) + 11];
+  strcpy(payload, commandName);
+  strcat(payload, " ");
+  strcat(payload, result);
+  strcat(payload, " ");
+  ultoa(latency, &payload[strlen(payload)], 10);
+
+  return publishMQTTMessage(MQTTCommandTopic, payload, MQTTNotRetain);
+}
+
+// Writes a value as 2 characters in the given base
+static void formatByte (char* text, byte value, byte base)
+{
+  static char const digits[] = "0123456789ABCDEF";
+  text[0] = digits[value / base];
+  text[1] = digits[value % base];
+}
+
+// Publishes a panel event: "YYYY-MM-DD HH:MM P CC AA"
+static bool publishPanelEvent (dscPanelEvent const & event)
+{
+  char payload[] = "0000-00-00 00:00 0 00 00";
+  unsigned int const year = 1900 + event.year;
+
+  formatByte(&payload[0], year / 100, 10);
+  formatByte(&payload[2], year % 100, 10);
+  formatByte(&payload[5], event.month, 10);
+  formatByte(&payload[8], event.day, 10);
+  formatByte(&payload[11], event.hour, 10);
+  formatByte(&payload[14], event.minute, 10);
+  payload[17] = '0' + event.partition;
+  formatByte(&payload[19], event.eventClass, 16);
+  formatByte(&payload[22], event.argument, 16);
+
+  return publishMQTTMessage(MQTTEventTopic, payload, MQTTNotRetain);
+}
+
+#if defined(DSC_LATENCY_STATS)
+// Prints the latency histograms periodically
+static void printLatencyHistogram (__FlashStringHelper const * const sName, dscLatencyHistogram const & histogram)
+{
+  Serial.print(sName);
+  Serial.print(F(" max "));
+  Serial.print(histogram.maxLatency);
+  Serial.print(F("ms:"));
+  for(byte bucket = 0; bucket < dscLatencyBuckets; bucket++)
+  {
+    Serial.print(F(" "));
+    Serial.print(histogram.buckets[bucket]);
+  }
+  Serial.println();
+}
+
+static void printLatencyStats (void)
+{
+  static unsigned long previousReport;
+  unsigned long const current = millis();
+  if((current - previousReport) >= LatencyReportInterval_ms)
+  {
+    previousReport = current;
+    printLatencyHistogram(F("Decode latency"), dsc.decodeLatency);
+    printLatencyHistogram(F("Publish latency"), dsc.publishLatency);
+    printLatencyHistogram(F("Write latency"), dsc.writeLatency);
+    printLatencyHistogram(F("Alarm verify latency"), dsc.alarmVerifyLatency);
   }
 }
+#endif